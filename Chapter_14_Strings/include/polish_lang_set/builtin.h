@@ -3,18 +3,33 @@
 
 #include "lang_set.h" // For Parser to load
 #include "lval_lenv.h"
+#include "lval_alloc.h"
+#include "lval_gc.h"
 
 lval *builtin_op(lenv *, lval *, char *);
+
+// Builtin functions
+// Rather than binding each builtin in the global environment, the
+// static table in builtin.c is hung off the interned names by
+// lenv_add_builtins. Builtins are looked up after user bindings, not
+// before: lenv_get only falls back to one once no environment binds the
+// name, so a def of + shadows the builtin +.
+typedef struct lbuiltin_entry {
+    char *name;
+    lval value; // immortal function node, never written
+} lbuiltin_entry;
+
+extern lbuiltin_entry lbuiltins[];
+extern const int lbuiltin_count;
+
 void lenv_add_builtins(lenv *);
 
 // Numeric constants
 // Block statement to avoid redefinition error during simultaneous defn
 #define LENV_DEF_CONST(env, name, input, constructor) { \
     lval *key = lval_sym(name); \
-    lval *value = constructor(input); \
-    lenv_put(env, key, value); \
+    lenv_def_const(env, key, constructor(input)); \
     lval_free(key); \
-    lval_free(value); \
 }
 
 // ## removes leading comma when no args passed
@@ -26,9 +41,9 @@ void lenv_add_builtins(lenv *);
     }
 
 #define LASSERT_TYPE(args, func, index, expected) \
-    LASSERT(args, args->cell[index]->type == expected, \
+    LASSERT(args, lval_type(args->cell[index]) == expected, \
         "Function '%s' passed incorrect type at argument %d. Expected %s instead of %s.", \
-        func, index, lval_type_name(expected), lval_type_name(args->cell[index]->type));
+        func, index, lval_type_name(expected), lval_type_name(lval_type(args->cell[index])));
 
 #define LASSERT_NUM(args, func, num) \
     LASSERT(args, args->count == num, \
@@ -42,6 +57,11 @@ void lenv_add_builtins(lenv *);
 lval *builtin_load(lenv *, lval *);
 lval *builtin_print(lenv *, lval *);
 lval *builtin_error(lenv *, lval *);
+lval *builtin_mem(lenv *, lval *);
+lval *builtin_gc(lenv *, lval *);
+lval *builtin_arena(lenv *, lval *);
+lval *builtin_hashcons(lenv *, lval *);
+lval *builtin_quota(lenv *, lval *);
 
 lval *builtin_compare_bool(lenv *, lval *, char *);
 lval *builtin_or(lenv *, lval *);
@@ -69,6 +89,7 @@ lval *builtin_min(lenv *, lval *);
 lval *builtin_lambda(lenv *, lval *);
 lval *builtin_def(lenv *, lval *);
 lval *builtin_put(lenv *, lval *);
+lval *builtin_defconst(lenv *, lval *);
 lval *builtin_var(lenv *, lval *, char *);
 
 lval *builtin_head(lenv *, lval *);
@@ -0,0 +1,121 @@
+#ifndef lval_alloc_h
+#define lval_alloc_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Slab allocator for lval nodes and their attached data
+//
+// Memory is requested from malloc in pages of LALLOC_PAGE_SIZE bytes,
+// which are carved into equal sized slots and threaded onto a free list.
+// Freed slots go back on their free list instead of back to malloc, so a
+// long REPL session reuses the same few pages rather than fragmenting.
+//
+// lval nodes have one pool per kind of lval, while strings, cell arrays
+// and lenv tables are served from power-of-two size classes. Requests
+// larger than the largest class go straight to malloc.
+//
+// Data frees are sized: the caller passes back the size it asked for,
+// which it always knows (strlen + 1, count * sizeof(lval *), ...), so
+// slots need no header.
+//
+// Node pools work as a nursery. Each pool allocates from one current page,
+// taking fresh slots with a bump pointer, and frees go back to the free
+// list of the page the node lives in (pages are aligned to their size, so
+// that page is found by masking the address). Temporaries die on the page
+// they were born on. Nodes still live when the page is left behind are
+// promoted in place: the page is retired until most of it has been freed,
+// and a page whose nodes have all died is recycled whole by resetting its
+// bump pointer.
+//
+// Node pools keep the first LVAL_NODE_HEADER bytes of a freed slot intact,
+// so a free node reads as refcount 0. This lets the tracing collector walk
+// every slot below the bump pointer with lalloc_each_node.
+//
+// Node pools also have an arena: separate pages that scratch nodes of a
+// top-level form are bump allocated from and that are emptied together by
+// lalloc_arena_reset, instead of being freed node by node. Each pool's
+// arena is capped at LALLOC_ARENA_PAGES pages, after which
+// lalloc_arena_node returns NULL and the caller falls back to the pool.
+
+#define LALLOC_PAGE_SIZE 65536
+#define LALLOC_MIN_CLASS 8
+#define LALLOC_MAX_CLASS 512
+#define LALLOC_ARENA_PAGES 16
+
+// Node pools, one per kind of lval (Q and S-expressions share a pool
+// since builtins flip between the two types in place)
+enum { LPOOL_NUM, LPOOL_ERR, LPOOL_SYM, LPOOL_STR, LPOOL_FUNC, LPOOL_LIST,
+       LPOOL_NODE_COUNT };
+
+typedef struct lpool {
+    char *name;
+    size_t size; // slot size
+    size_t header; // bytes left untouched while a slot is free
+    void *free_list; // each free slot links to the next just past its header
+    void *pages;
+    void *current; // node pools: page new nodes are allocated from
+    void *empty; // node pools: retired pages with no live nodes
+    void *partial; // node pools: retired pages at most half live
+    void *arena; // node pools: arena pages, in allocation order
+    void *arena_current;
+    long page_count;
+    long arena_page_count;
+    long recycled; // node pools: emptied pages reset for reuse
+    long live; // slots handed out and not yet freed
+    long peak; // high-water mark of live
+    long total; // slots handed out since startup
+} lpool;
+
+// Node allocation
+void *lalloc_node(int);
+void lfree_node(void *, int);
+void lalloc_each_node(void (*)(void *));
+long lalloc_live_nodes(void);
+
+// Arena allocation
+void *lalloc_arena_node(int);
+void lalloc_arena_each(void (*)(void *));
+void lalloc_arena_reset(void);
+
+// Sized data allocation
+void *lalloc(size_t);
+void *lrealloc(void *, size_t, size_t);
+void lfree(void *, size_t);
+char *lalloc_strdup(char *);
+
+// Statistics
+void lalloc_print_stats(void);
+
+// Quota contexts
+// Every byte handed out by lalloc_node, lalloc and lrealloc is charged to
+// the active context, and credited back to whichever context is active
+// when it is freed. The lval layer records the context of each node and
+// makes it active again while the node is freed, so memory stays with
+// the tenant that allocated it. Arena nodes are not charged, the arena is
+// bounded by LALLOC_ARENA_PAGES anyway.
+//
+// Allocations never fail on a quota: a context may briefly run over its
+// limit, and lquota_over tells the evaluator to stop with an error.
+// Context 0 is the global context, which has no limit.
+
+#define LQUOTA_MAX 16
+#define LQUOTA_NAME 32
+
+typedef struct lquota {
+    char name[LQUOTA_NAME];
+    long limit; // bytes, 0 for no limit
+    long current;
+    long peak;
+} lquota;
+
+extern int lquota_active; // index of the context being charged
+
+int lquota_find(char *, int);
+void lquota_set_limit(int, long);
+int lquota_over(void);
+void lquota_move(size_t, int, int);
+void lquota_print_stats(void);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef lval_defer_h
+#define lval_defer_h
+
+#include "lval_lenv.h"
+
+// Background freeing of large expressions
+//
+// Dropping the last reference to a big list, e.g. when a large dataset is
+// rebound with def, would release every one of its nodes on the spot.
+// Instead, a list whose cell array holds at least LDEFER_MIN_CELLS
+// children is queued, and a background thread frees it while the REPL
+// waits for the next line of input. Smaller values are freed inline.
+//
+// The pools and refcounts are not thread safe, so the heap is guarded by
+// a single mutex. The main thread holds it at all times except between
+// ldefer_idle_begin and ldefer_idle_end around readline, which is when
+// the background thread gets to free the queue. It frees at most
+// LDEFER_SLICE nodes at a time and queues the rest of a list again, so
+// taking the heap back waits for one slice at most, not a whole list.
+//
+// Files loaded from the command line or with load run without a pause
+// for input, so lists dropped meanwhile are only freed in the background
+// once the REPL waits. Beyond LDEFER_MAX_PENDING of them they are freed
+// inline, as before ldefer_start has run. ldefer_drain frees the queue
+// on the calling thread, as done before each tracing collection.
+
+#define LDEFER_MIN_CELLS 1024
+#define LDEFER_MAX_PENDING 256
+#define LDEFER_SLICE 4096 // nodes freed per hold of the heap
+
+void ldefer_start(void);
+int ldefer_push(lval *);
+void ldefer_drain(void);
+void ldefer_idle_begin(void);
+void ldefer_idle_end(void);
+void ldefer_print_stats(void);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef lval_gc_h
+#define lval_gc_h
+
+#include "lval_lenv.h"
+#include "lval_alloc.h"
+#include "lval_intern.h"
+#include "lval_defer.h"
+
+// Optional tracing mark-and-sweep collector
+//
+// Reference counting stays the primary way memory is reclaimed. The
+// collector is a backstop for nodes that are still allocated but can no
+// longer be reached, whether leaked by a missed lval_free or kept alive
+// only by each other, and returns them to their pools.
+//
+// Roots are the environments and in-flight values registered with
+// lgc_push_env / lgc_push_root; a registered environment roots its whole
+// parent chain. The hash-consing table is a root as well. Builtins keep
+// values in C locals the collector cannot see, so collections only happen
+// at safepoints outside of any function call: between top-level REPL
+// expressions and between the expressions of a file loaded from the
+// command line.
+//
+// Automatic collection is off until a growth factor is set. A collection
+// is then triggered once the live node count exceeds growth times the
+// count left by the previous collection.
+
+#define LGC_MIN_THRESHOLD 4096
+
+extern int lgc_call_depth; // function calls currently in progress
+
+void lgc_push_root(lval *);
+void lgc_pop_root(void);
+void lgc_push_env(lenv *);
+void lgc_pop_env(void);
+
+void lgc_safepoint(void);
+void lgc_request(void);
+void lgc_set_growth(long);
+long lgc_collect(void);
+void lgc_print_stats(void);
+
+#endif
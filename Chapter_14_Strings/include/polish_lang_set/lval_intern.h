@@ -0,0 +1,63 @@
+#ifndef lval_intern_h
+#define lval_intern_h
+
+#include "lval_lenv.h"
+
+// Optional hash-consing of Q-expression literals and function bodies
+//
+// When on, Q-expressions read by the parser and the formals and body of
+// every lambda are interned: each structurally distinct subtree is kept
+// once in a table keyed by a structural hash, and identical subtrees
+// share that one node. Loading a library that repeats the same code
+// shapes then keeps a single copy of each.
+//
+// Interning works bottom up, so a list is only interned once all of its
+// children are. Two interned nodes are therefore equal exactly when they
+// are the same node, which lets lval_eq answer from their addresses.
+// Symbols in lambda bodies are the exception, as they keep a slot hint
+// (see lval_resolve). Nodes differing only in hints are interned apart,
+// so nodes holding any are flagged and lval_eq compares them in full.
+// Functions and errors are never interned, nor is any list holding one.
+//
+// The table holds a reference to every node in it. Interned nodes are
+// thus always shared and copy on write keeps them immutable. Entries no
+// one else refers to any more are purged when the table fills up and
+// before each tracing collection, which treats the table as a root.
+//
+// Turning interning off again only stops new values from being interned.
+// The table lives on, so nodes interned earlier stay canonical.
+
+void lintern_set(int);
+lval *lintern_value(lval *);
+void lintern_purge(void);
+void lintern_each(void (*)(lval *));
+void lintern_print_stats(void);
+
+// Symbol names
+// Every symbol points at the single copy of its name kept in a process
+// wide table, so symbols and environment keys are compared by address.
+// Names are never freed, a program only ever uses so many of them.
+// Names the evaluator looks for are interned up front.
+//
+// Each name also counts how many bindings of it all live environments
+// hold together, kept up to date by lenv_put_move, lenv_copy and
+// lenv_release. It also points at the builtin or the constant of that
+// name if there is one, and holds the value cell of the global variable
+// of that name.
+typedef struct lsym_name {
+    int bindings;
+    int global_slot; // position in the global environment, -1 if unbound
+    lval *global; // value bound there, see lenv_new_global
+    lval *builtin; // see lenv_add_builtins
+    lval *constant; // see lenv_def_const
+    char text[];
+} lsym_name;
+
+#define LSYM_NAME(sym) ((lsym_name *) ((sym) - offsetof(lsym_name, text)))
+
+extern char *lsym_rest; // &
+extern char *lsym_dir; // dir
+
+char *lintern_sym(char *);
+
+#endif
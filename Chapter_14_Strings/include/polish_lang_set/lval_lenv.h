@@ -7,66 +7,195 @@
 #include <limits.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "mpc.h"
 
 struct lval;
 struct lenv;
+struct lvec;
 typedef struct lval lval;
 typedef struct lenv lenv;
 
+// Children stored inside an expression node before spilling to the heap
+#define LVAL_SMALL_CELLS 4
+
 // Function pointer
 // lbuiltin is pointer to function that takes in lenv* and lval*.
 typedef lval *(*lbuiltin)(lenv *, lval *);
 
+// Only the union member matching type is ever valid, so the fields of
+// different types overlap instead of sitting side by side. Each type is
+// allocated with just enough room for its own member (see LVAL_NODE_SIZE),
+// e.g. a string node takes 16 bytes rather than sizeof(lval).
+//
+// Heap lvals are reference counted and may be shared by any number of
+// lists and environments. lval_ref takes another reference and lval_free
+// drops one. A shared lval must never be modified: call lval_unshare
+// first, which hands back a private copy if anyone else holds it.
 struct lval {
-    int type; // specifies type of lval and field to access
-
-    // Basic types
-    long num; // successful num result (stores boolean as well);
-    char *err; // runtime error code
-    char *sym; // symbol string data
-    char *str;
-
-    // Function types
-    lbuiltin builtin;
-    lenv *env;
-    lval *formals;
-    lval *body;
-
-    // Expression types
-    int count; // lval* count
-    struct lval** cell;
+    unsigned char type; // specifies type of lval and field to access
+    unsigned char flags; // LVAL_FLAG_* bits
+    unsigned char quota; // quota context charged for the node
+    unsigned char slot; // symbols: 1 + binding resolved to, 0 if none
+    int refcount; // number of owners, zero while the slot is free
+
+    union {
+        // Basic types
+        long num; // number too wide to be an immediate fixnum
+        char *err; // runtime error code
+        char *sym; // interned name
+        char *str;
+
+        // Function types
+        struct {
+            lbuiltin builtin;
+            lenv *env;
+            lval *formals;
+            lval *body;
+        };
+
+        // Expression types
+        // cell points front slots into small, or into vec once the
+        // children no longer fit
+        struct {
+            int count; // lval* count
+            int front; // slots before the first child
+            struct lval** cell;
+            struct lvec* vec;
+            struct lval* small[LVAL_SMALL_CELLS];
+        };
+    };
 };
 
+// Expressions with up to this many children need no separate cell array
+#define LVAL_CELLS_INLINE(list) ((list)->vec == NULL)
+#define LVAL_CAPACITY(list) \
+    ((list)->vec ? (list)->vec->capacity : LVAL_SMALL_CELLS)
+
+// Reference counted cell array of a larger expression
+// Several expressions may view slices of the same array: tail, init and
+// head of a shared list take no copy. The array holds the references of
+// items[lo] to items[hi - 1], which covers the view of every expression
+// using it. An expression only modifies the array in place when it is the
+// sole user and views exactly that range (see lval_own_cells).
+typedef struct lvec {
+    int refcount;
+    int capacity;
+    int lo, hi;
+    unsigned mark; // collection that last traced it
+    lval *items[];
+} lvec;
+
+// Bytes needed by a node whose last used field is member
+#define LVAL_NODE_SIZE(member) \
+    (offsetof(lval, member) + sizeof(((lval *) 0)->member))
+// Bytes of type, flags, quota, slot and refcount in front of the union
+#define LVAL_NODE_HEADER offsetof(lval, num)
+
+// lval flags
+#define LVAL_FLAG_MARKED 0x1 // reached during a tracing collection
+#define LVAL_FLAG_GARBAGE 0x2 // found unreachable, only set during a sweep
+#define LVAL_FLAG_SCRATCH 0x4 // allocated during an arena form
+#define LVAL_FLAG_ARENA 0x8 // lives in the arena, freed when it is reset
+#define LVAL_FLAG_INTERNED 0x10 // canonical node held by the intern table
+#define LVAL_FLAG_IMMORTAL 0x20 // static node, never freed nor modified
+#define LVAL_FLAG_HINTED 0x40 // interned node holding slot hints, see lval_intern.h
+
 // Environment to store variables
+// Bindings are kept in order of definition, sym-val pair at each index.
+// Up to LENV_SCAN_MAX of them are searched by comparing interned names,
+// larger environments add an open addressing index with twice as many
+// slots as there is room for bindings, each holding a binding's position
+// or -1. Room doubles as bindings are added.
+//
+// The environment of a function is shared by all copies of it and
+// reference counted like an lval. It is only copied when a call is about
+// to bind arguments into a shared one (see lenv_unshare).
+//
+// The global environment also keeps each of its values in the value cell
+// of the bound name, so globals are read and rebound without a search.
+// There is a single global environment, the root of every lookup.
 struct lenv {
-    // sym-val pair at each index
+    int refcount;
     lenv *parent;
+    int scratch; // owned by a scratch function, values are not promoted
+    int global; // made by lenv_new_global
     int count;
+    int capacity; // room in syms and vals
     char **syms;
     lval **vals;
+    int *index; // NULL while small enough to scan
 };
 
+#define LENV_SCAN_MAX 8
+#define LENV_INDEX_SIZE(env) ((env)->capacity * 2)
+
 // lenv constructors and deconstructors
 lenv *lenv_new(void);
+lenv *lenv_new_global(void);
 void lenv_free(lenv *);
+void lenv_release(lenv *);
+lenv *lenv_ref(lenv *);
+lenv *lenv_unshare(lenv *);
+lenv *lenv_frame(int);
+void lenv_frame_release(lenv *);
 
 // Accessors
 lval *lenv_get(lenv *, lval *);
 void lenv_put(lenv *, lval *, lval *);
+void lenv_put_move(lenv *, lval *, lval *);
 lenv *lenv_copy(lenv *);
 void lenv_def(lenv *, lval *, lval *);
+void lenv_def_const(lenv *, lval *, lval *);
+void lenv_def_move(lenv *, lval *, lval *);
 void lval_check_get_replace(lenv *, lval *);
 void lval_get_replace(lenv *, lval *);
 void lenv_print_dir(lenv *);
-void lenv_add_builtin_func(lenv *, char *, lbuiltin);
 void lenv_add_builtin_const(lenv *, char *, lval *);
 
 // lval types
 enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_STR,
        LVAL_FUNC, LVAL_SEXPR, LVAL_QEXPR, LVAL_BOOL };
 
+// Immediate values
+// Numbers and booleans are packed into the lval* word itself instead of
+// being malloc'd, so arithmetic and comparisons cause no heap traffic.
+// Heap lvals are slab slots: node pages are aligned to their size, and
+// the page header and every LVAL_NODE_SIZE pool slot are multiples of 4
+// (checked in lval_alloc.c, along with the alignment of static lvals), so
+// the low two bits of a real pointer are always clear:
+//     ...x1  fixnum, value held in the remaining bits
+//     ...10  boolean, value held in bit 2
+// Numbers too wide for a fixnum fall back to a boxed LVAL_NUM.
+// Read the type and number of any lval through lval_type / lval_num_value.
+#define LVAL_TAG_MASK 0x3
+#define LVAL_TAG_FIXNUM 0x1
+#define LVAL_TAG_BOOL 0x2
+#define LVAL_FIXNUM_MAX (INTPTR_MAX / 2)
+#define LVAL_FIXNUM_MIN (-LVAL_FIXNUM_MAX - 1)
+
+static inline int lval_is_immediate(lval *value) {
+    return ((uintptr_t) value & LVAL_TAG_MASK) != 0;
+}
+
+static inline int lval_type(lval *value) {
+    if ((uintptr_t) value & LVAL_TAG_FIXNUM) { return LVAL_NUM; }
+    if ((uintptr_t) value & LVAL_TAG_BOOL) { return LVAL_BOOL; }
+    return value->type;
+}
+
+static inline long lval_num_value(lval *value) {
+    if ((uintptr_t) value & LVAL_TAG_FIXNUM) {
+        // Division rather than >> keeps negative fixnums portable
+        return (long) ((intptr_t) ((uintptr_t) value - 1) / 2);
+    }
+    if ((uintptr_t) value & LVAL_TAG_BOOL) { return ((uintptr_t) value >> 2) & 1; }
+    return value->num;
+}
+
 // lval constructors and deconstructors
+int lval_pool(int);
 lval *lval_num(long);
 lval *lval_bool(char);
 lval *lval_err(char *, ...);
@@ -76,7 +205,25 @@ lval *lval_func(lbuiltin);
 lval *lval_lambda(lval *, lval *);
 lval *lval_sexpr(void);
 lval *lval_qexpr(void);
+lval *lval_empty(void);
 void lval_free(lval *);
+void lval_reclaim(lval *);
+long lval_reclaim_some(lval *, long, void (*)(lval *));
+lval *lval_ref(lval *);
+lval *lval_unshare(lval *);
+void lval_own_cells(lval *);
+void lvec_free(lvec *);
+
+// Arena mode
+// When on, each top-level form allocates its nodes from an arena which is
+// emptied in one step once the form is done. Values stored into a lasting
+// environment are promoted out of it with lval_promote.
+void lval_set_arena(int);
+int lval_arena_begin(void);
+void lval_arena_end(void);
+lval *lval_promote(lval *);
+int lval_arena_suspend(void);
+void lval_arena_resume(int);
 
 // lval methods
 int lval_bool_value(lval *);
@@ -84,13 +231,14 @@ char *lval_type_name(int);
 int lval_eq(lval *, lval *);
 lval *lval_add(lval *, lval *);
 lval *lval_insert(lval *, lval *, int);
+lval *lval_insert_move(lval *, lval *, int);
 lval *lval_pop(lval *, int);
 lval *lval_extract(lval *, int);
+lval *lval_slice(lval *, int, int);
 lval *lval_copy(lval *);
 lval *lval_join(lval *, lval *);
 
 // lval display
-void lval_expr_print(lval *, char, char);
 void lval_print(lval *);
 void lval_println(lval *);
 void lval_print_str(lval *);
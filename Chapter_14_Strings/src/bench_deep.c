@@ -0,0 +1,93 @@
+// Benchmark for traversals of deeply nested values
+//
+// Builds chains {{{...}}} of increasing depth and times lval_copy,
+// lval_eq, lval_print, lval_promote and lval_free on them. A copy shares
+// the children of the original and takes the same time at every depth,
+// while promotion copies the whole chain. Everything runs on a thread
+// with only BENCH_STACK_SIZE bytes of stack, far too little for a C
+// stack frame per nesting level, so getting through the deepest chain at
+// all shows the traversals use constant C stack.
+//
+// Usage: bench_deep > /dev/null
+// Printed chains go to stdout, timings to stderr.
+
+#include <pthread.h>
+#include <time.h>
+#include "lval_lenv.h"
+
+#define BENCH_STACK_SIZE (64 * 1024)
+#define BENCH_MAX_DEPTH 1000000
+
+static lval *bench_chain(int depth) {
+    lval *value = lval_qexpr();
+    int i;
+    for (i = 0; i < depth; i++) {
+        value = lval_add(lval_qexpr(), value);
+    }
+    return value;
+}
+
+static double bench_seconds(clock_t start) {
+    return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void *bench_run(void *arg) {
+    (void) arg;
+    int depth;
+    for (depth = 1000; depth <= BENCH_MAX_DEPTH; depth *= 10) {
+        clock_t start = clock();
+        lval *a = bench_chain(depth);
+        lval *b = bench_chain(depth);
+        double build = bench_seconds(start);
+
+        start = clock();
+        lval *copy = lval_copy(a);
+        double copying = bench_seconds(start);
+
+        start = clock();
+        int equal = lval_eq(a, b);
+        double eq = bench_seconds(start);
+        equal = equal && lval_eq(copy, b);
+
+        start = clock();
+        lval_println(a);
+        double print = bench_seconds(start);
+
+        // Promotion copies a chain built during an arena form
+        lval_set_arena(1);
+        lval_arena_begin();
+        lval *scratch = bench_chain(depth);
+        start = clock();
+        lval *promoted = lval_promote(scratch);
+        double promote = bench_seconds(start);
+        lval_arena_end();
+        lval_set_arena(0);
+
+        start = clock();
+        lval_free(a);
+        lval_free(b);
+        lval_free(copy);
+        lval_free(promoted);
+        double release = bench_seconds(start);
+
+        fprintf(stderr, "depth %7d: build %.3fs, copy %.3fs, eq %.3fs (%s), "
+            "print %.3fs, promote %.3fs, free %.3fs\n", depth, build, copying,
+            eq, equal ? "equal" : "NOT EQUAL", print, promote, release);
+    }
+    return NULL;
+}
+
+int main(void) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, BENCH_STACK_SIZE);
+
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, bench_run, NULL) != 0) {
+        fprintf(stderr, "Could not start benchmark thread\n");
+        return 1;
+    }
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+    return 0;
+}
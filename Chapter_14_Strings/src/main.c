@@ -2,6 +2,7 @@
 #include "mpc.h"
 #include "lang_set.h"
 #include "builtin.h"
+#include "lval_gc.h"
 
 // Evaluation of mathematical results with polish notation
 int main(int argc, char **argv) {
@@ -11,7 +12,10 @@ int main(int argc, char **argv) {
     parser_set_t *parser_set = polish_notation_set();
     if (parser_set == NULL) { exit(1); }
 
-    lenv *env = lenv_new();
+    ldefer_start(); // Large values are freed while waiting for input
+    lenv *env = lenv_new_global();
+    lgc_push_env(env); // Global environment roots the tracing collector
+    lenv_add_builtins(env);
     // Command line arguments are provided, i.e. filenames
     // Load environment with library
     if (argc > 1) {
@@ -19,17 +23,18 @@ int main(int argc, char **argv) {
         for (i = 1; i < argc; i++) {
             lval *args = lval_add(lval_sexpr(), lval_str(argv[i]));
             lval *result = builtin_load(env, args);
-            if (result->type == LVAL_ERR) { lval_println(result); }
+            if (lval_type(result) == LVAL_ERR) { lval_println(result); }
             lval_free(result); // args freed in builtin_load
         }
     }
 
 
     // REPL Interpreter
-    lenv_add_builtins(env);
     puts("Type 'dir' for available functions.");
     while (1) {
+        ldefer_idle_begin();
         char *input = readline(">>> ");
+        ldefer_idle_end();
         if (strcmp(input, ":q") == 0) { break; } // exit
         add_history(input);
 
@@ -37,10 +42,13 @@ int main(int argc, char **argv) {
         mpc_result_t r;
         if (mpc_parse("<stdin>", input, parser_set->parser, &r)) {
             // Interpretation successful
+            int arena = lval_arena_begin();
             lval *value = lval_eval(env, lval_read(r.output));
             lval_println(value);
             lval_free(value);
+            if (arena) { lval_arena_end(); }
             mpc_ast_delete(r.output);
+            lgc_safepoint();
         } else {
             mpc_err_print(r.error);
             mpc_err_delete(r.error);
@@ -48,7 +56,9 @@ int main(int argc, char **argv) {
         free(input);
     }
 
+    lgc_pop_env();
     lenv_free(env);
+    ldefer_drain();
     clear_parser_set(parser_set);
     return 0;
 }
@@ -3,46 +3,68 @@
 
 #include "builtin.h"
 
-void lenv_add_builtins(lenv *env) {
-
-    lenv_add_builtin_func(env, "load", builtin_load);
-    lenv_add_builtin_func(env, "error", builtin_error);
-    lenv_add_builtin_func(env, "print", builtin_print);
-
-    lenv_add_builtin_func(env, "def", builtin_def); // Global assignment
-    lenv_add_builtin_func(env, "=", builtin_put); // Local assignment
-    lenv_add_builtin_func(env, "\\", builtin_lambda);
+// Every builtin function, declared once
+// The function nodes are static and immortal, so registering a builtin
+// allocates nothing. lenv_add_builtins only points each name at its node.
+// Like empty_sexpr, the nodes are not const: they are handed out as plain
+// lvals, and only their immortal flag keeps them from being written.
+#define LBUILTIN(func) \
+    { .type = LVAL_FUNC, .flags = LVAL_FLAG_IMMORTAL, .refcount = 2, .builtin = func }
+
+lbuiltin_entry lbuiltins[] = {
+    { "load", LBUILTIN(builtin_load) },
+    { "error", LBUILTIN(builtin_error) },
+    { "print", LBUILTIN(builtin_print) },
+    { "mem", LBUILTIN(builtin_mem) },
+    { "gc", LBUILTIN(builtin_gc) },
+    { "arena", LBUILTIN(builtin_arena) },
+    { "hashcons", LBUILTIN(builtin_hashcons) },
+    { "quota", LBUILTIN(builtin_quota) },
+
+    { "def", LBUILTIN(builtin_def) }, // Global assignment
+    { "=", LBUILTIN(builtin_put) }, // Local assignment
+    { "defconst", LBUILTIN(builtin_defconst) }, // Global constant
+    { "\\", LBUILTIN(builtin_lambda) },
 
     // Comparisons
-    lenv_add_builtin_func(env, "or", builtin_or);
-    lenv_add_builtin_func(env, "and", builtin_and);
-    lenv_add_builtin_func(env, "==", builtin_eq);
-    lenv_add_builtin_func(env, "!=", builtin_neq);
-    lenv_add_builtin_func(env, ">", builtin_greater);
-    lenv_add_builtin_func(env, ">=", builtin_greater_eq);
-    lenv_add_builtin_func(env, "<", builtin_lesser);
-    lenv_add_builtin_func(env, "<=", builtin_lesser_eq);
-    lenv_add_builtin_func(env, "bool", builtin_bool);
-    lenv_add_builtin_func(env, "!", builtin_negate);
-    lenv_add_builtin_func(env, "if", builtin_if);
-
-    lenv_add_builtin_func(env, "list", builtin_list);
-    lenv_add_builtin_func(env, "head", builtin_head);
-    lenv_add_builtin_func(env, "tail", builtin_tail);
-    lenv_add_builtin_func(env, "eval", builtin_eval);
-    lenv_add_builtin_func(env, "join", builtin_join);
-    lenv_add_builtin_func(env, "cons", builtin_cons);
-    lenv_add_builtin_func(env, "len", builtin_len);
-    lenv_add_builtin_func(env, "init", builtin_init);
-
-    lenv_add_builtin_func(env, "+", builtin_add);
-    lenv_add_builtin_func(env, "-", builtin_sub);
-    lenv_add_builtin_func(env, "*", builtin_mul);
-    lenv_add_builtin_func(env, "/", builtin_div);
-    lenv_add_builtin_func(env, "%", builtin_mod);
-    lenv_add_builtin_func(env, "^", builtin_pow);
-    lenv_add_builtin_func(env, "max", builtin_max);
-    lenv_add_builtin_func(env, "min", builtin_min);
+    { "or", LBUILTIN(builtin_or) },
+    { "and", LBUILTIN(builtin_and) },
+    { "==", LBUILTIN(builtin_eq) },
+    { "!=", LBUILTIN(builtin_neq) },
+    { ">", LBUILTIN(builtin_greater) },
+    { ">=", LBUILTIN(builtin_greater_eq) },
+    { "<", LBUILTIN(builtin_lesser) },
+    { "<=", LBUILTIN(builtin_lesser_eq) },
+    { "bool", LBUILTIN(builtin_bool) },
+    { "!", LBUILTIN(builtin_negate) },
+    { "if", LBUILTIN(builtin_if) },
+
+    { "list", LBUILTIN(builtin_list) },
+    { "head", LBUILTIN(builtin_head) },
+    { "tail", LBUILTIN(builtin_tail) },
+    { "eval", LBUILTIN(builtin_eval) },
+    { "join", LBUILTIN(builtin_join) },
+    { "cons", LBUILTIN(builtin_cons) },
+    { "len", LBUILTIN(builtin_len) },
+    { "init", LBUILTIN(builtin_init) },
+
+    { "+", LBUILTIN(builtin_add) },
+    { "-", LBUILTIN(builtin_sub) },
+    { "*", LBUILTIN(builtin_mul) },
+    { "/", LBUILTIN(builtin_div) },
+    { "%", LBUILTIN(builtin_mod) },
+    { "^", LBUILTIN(builtin_pow) },
+    { "max", LBUILTIN(builtin_max) },
+    { "min", LBUILTIN(builtin_min) },
+};
+
+const int lbuiltin_count = sizeof(lbuiltins) / sizeof(lbuiltin_entry);
+
+void lenv_add_builtins(lenv *env) {
+    int i;
+    for (i = 0; i < lbuiltin_count; i++) {
+        LSYM_NAME(lintern_sym(lbuiltins[i].name))->builtin = &lbuiltins[i].value;
+    }
 
     // Constants!
     LENV_DEF_CONST(env, "true", 1, lval_bool);
@@ -62,18 +84,29 @@ lval *builtin_load(lenv *env, lval *args) {
         lval *expr = lval_read(result.output);
         mpc_ast_delete(result.output);
 
+        // Remaining expressions are in flight across collector safepoints
+        lgc_push_env(env);
+        lgc_push_root(args);
+        lgc_push_root(expr);
+
         // Evaluate string
         while (expr->count) {
+            int arena = lval_arena_begin();
             lval *value = lval_eval(env, lval_pop(expr, 0));
-            if (value->type == LVAL_ERR) {
+            if (lval_type(value) == LVAL_ERR) {
                 lval_println(value);
             }
             lval_free(value);
+            if (arena) { lval_arena_end(); }
+            lgc_safepoint();
         }
 
+        lgc_pop_root();
+        lgc_pop_root();
+        lgc_pop_env();
         lval_free(expr);
         lval_free(args);
-        return lval_sexpr();
+        return lval_empty();
     } else {
         // Get parse error as string and return lval error
         char *err_msg = mpc_err_string(result.error);
@@ -94,7 +127,78 @@ lval *builtin_print(lenv *env, lval *args) {
     }
     putchar('\n');
     lval_free(args);
-    return lval_sexpr();
+    return lval_empty();
+}
+
+// Print allocator statistics
+// Takes a dummy argument, since (mem) alone evaluates to the function
+lval *builtin_mem(lenv *env, lval *args) {
+    lalloc_print_stats();
+    ldefer_print_stats();
+    lval_free(args);
+    return lval_empty();
+}
+
+// Tracing collector control
+//     gc ()  - collect once the current top-level expression is done
+//     gc n   - collect automatically when live nodes grow n-fold, 0 for never
+lval *builtin_gc(lenv *env, lval *args) {
+    LASSERT_NUM(args, "gc", 1);
+    if (lval_type(args->cell[0]) == LVAL_NUM) {
+        LASSERT(args, lval_num_value(args->cell[0]) >= 0,
+            "Function 'gc' passed negative growth factor %ld.",
+            lval_num_value(args->cell[0]));
+        lgc_set_growth(lval_num_value(args->cell[0]));
+    } else {
+        lgc_request();
+    }
+    lgc_print_stats();
+    lval_free(args);
+    return lval_empty();
+}
+
+lval *builtin_arena(lenv *env, lval *args) {
+    /* Turn arena mode on or off for the following top-level forms */
+    LASSERT_NUM(args, "arena", 1);
+    lval_set_arena(lval_bool_value(args->cell[0]));
+    lval_free(args);
+    return lval_empty();
+}
+
+// Hash-consing control
+//     hashcons 1 - intern Q-expressions and function bodies from now on
+//     hashcons 0 - stop interning, interned values stay shared
+lval *builtin_hashcons(lenv *env, lval *args) {
+    LASSERT_NUM(args, "hashcons", 1);
+    lintern_set(lval_bool_value(args->cell[0]));
+    lintern_print_stats();
+    lval_free(args);
+    return lval_empty();
+}
+
+// Quota contexts
+//     quota ()          - print usage of every context
+//     quota "name" n    - charge the following forms to context name,
+//                         created if needed, limited to n bytes (0 for none)
+lval *builtin_quota(lenv *env, lval *args) {
+    if (args->count == 2) {
+        LASSERT_TYPE(args, "quota", 0, LVAL_STR);
+        LASSERT_TYPE(args, "quota", 1, LVAL_NUM);
+        LASSERT(args, lval_num_value(args->cell[1]) >= 0,
+            "Function 'quota' passed negative limit %ld.",
+            lval_num_value(args->cell[1]));
+        int index = lquota_find(args->cell[0]->str, 1);
+        LASSERT(args, index >= 0,
+            "Function 'quota' cannot create more than %d contexts.", LQUOTA_MAX);
+        lquota_set_limit(index, lval_num_value(args->cell[1]));
+        lquota_active = index;
+    } else {
+        LASSERT_NUM(args, "quota", 1);
+    }
+    ldefer_drain(); // Report memory in use, not memory waiting to be freed
+    lquota_print_stats();
+    lval_free(args);
+    return lval_empty();
 }
 
 // Allow user to define an error message
@@ -118,6 +222,10 @@ lval *builtin_put(lenv *env, lval *args) {
     return builtin_var(env, args, "=");
 }
 
+lval *builtin_defconst(lenv *env, lval *args) {
+    return builtin_var(env, args, "defconst");
+}
+
 // Symbol definition should be done inside qexpr
 // Otherwise an attempt to evaluate sexpr will yield
 // an unbound symbol error.
@@ -129,9 +237,27 @@ lval *builtin_var(lenv *env, lval *args, char *func) {
     lval *syms = args->cell[0];
     int i;
     for (i = 0; i < syms->count; i++) {
-        LASSERT(args, syms->cell[i]->type == LVAL_SYM,
+        LASSERT(args, lval_type(syms->cell[i]) == LVAL_SYM,
             "Function '%s' cannot define non-symbol. Expected %s instead of %s.",
-            func, lval_type_name(LVAL_SYM), lval_type_name(syms->cell[i]->type));
+            func, lval_type_name(LVAL_SYM), lval_type_name(lval_type(syms->cell[i])));
+        lsym_name *name = LSYM_NAME(syms->cell[i]->sym);
+        LASSERT(args, name->constant == NULL,
+            "Function '%s' cannot redefine constant '%s'.", func, syms->cell[i]->sym);
+    }
+
+    // Constants must be new names, so all are checked before any is bound
+    if (strcmp(func, "defconst") == 0) {
+        for (i = 0; i < syms->count; i++) {
+            char *sym = syms->cell[i]->sym;
+            lsym_name *name = LSYM_NAME(sym);
+            LASSERT(args, name->bindings == 0 && name->builtin == NULL,
+                "Function '%s' cannot make bound symbol '%s' a constant.", func, sym);
+            int j;
+            for (j = 0; j < i; j++) {
+                LASSERT(args, syms->cell[j]->sym != sym,
+                    "Function '%s' cannot define '%s' twice.", func, sym);
+            }
+        }
     }
 
     // Check number of symbols matches number of values
@@ -139,19 +265,26 @@ lval *builtin_var(lenv *env, lval *args, char *func) {
         "Function '%s' takes incorrect number of values. Expected %d instead of %d.",
         func, syms->count, args->count - 1);
 
-    // Assignment (global def, local put)
+    if (strcmp(func, "def") != 0 && strcmp(func, "=") != 0 && strcmp(func, "defconst") != 0) {
+        lval_free(args);
+        return lval_err("Internal reference error in builtin_var. Got %s.", func);
+    }
+
+    // Assignment (global def, local put, global defconst)
+    // Values are moved out of args into the environment
+    syms = lval_pop(args, 0);
     for (i = 0; i < syms->count; i++) {
-        if (strcmp(func, "def") == 0) {
-            lenv_put(env, syms->cell[i], args->cell[i+1]);
-        } else if (strcmp(func, "=") == 0) {
-            lenv_put(env, syms->cell[i], args->cell[i+1]);
+        if (strcmp(func, "defconst") == 0) {
+            lenv_def_const(env, syms->cell[i], lval_pop(args, 0));
+        } else if (strcmp(func, "def") == 0) {
+            lenv_def_move(env, syms->cell[i], lval_pop(args, 0));
         } else {
-            lval_free(args);
-            return lval_err("Internal reference error in builtin_var. Got %s.", func);
+            lenv_put_move(env, syms->cell[i], lval_pop(args, 0));
         }
     }
+    lval_free(syms);
     lval_free(args);
-    return lval_sexpr(); // success returns ()
+    return lval_empty(); // success returns ()
 }
 
 lval *builtin_lambda(lenv *env, lval *args) {
@@ -160,12 +293,14 @@ lval *builtin_lambda(lenv *env, lval *args) {
     LASSERT_TYPE(args, "\\", 0, LVAL_QEXPR);
     LASSERT_TYPE(args, "\\", 1, LVAL_QEXPR);
 
-    // Check formals only contain symbols
+    // Check formals only contain symbols, and no constants
     int i;
     for (i = 0; i < args->cell[0]->count; i++) {
-        LASSERT(args, args->cell[0]->cell[i]->type == LVAL_SYM,
+        LASSERT(args, lval_type(args->cell[0]->cell[i]) == LVAL_SYM,
             "Cannot define non-symbol. Expected %s instead of %s.",
-            lval_type_name(LVAL_SYM), lval_type_name(args->cell[0]->cell[i]->type));
+            lval_type_name(LVAL_SYM), lval_type_name(lval_type(args->cell[0]->cell[i])));
+        LASSERT(args, LSYM_NAME(args->cell[0]->cell[i]->sym)->constant == NULL,
+            "Cannot bind constant '%s' as an argument.", args->cell[0]->cell[i]->sym);
     }
 
     lval *formals = lval_pop(args, 0);
@@ -192,23 +327,21 @@ lval *builtin_compare_bool(lenv *env, lval *args, char *func) {
         LASSERT_TYPE(args, func, i, LVAL_BOOL);
     }
 
-    lval *result = lval_pop(args, 0);
-    while (args->count) {
-        lval *next = lval_pop(args, 0);
+    // Booleans are immediate, so fold over the values in place
+    long result = lval_num_value(args->cell[0]);
+    for (i = 1; i < args->count; i++) {
+        long next = lval_num_value(args->cell[i]);
         if (strcmp(func, "or") == 0) {
-            result->num = result->num || next->num;
+            result = result || next;
         } else if (strcmp(func, "and") == 0) {
-            result->num = result->num && next->num;
+            result = result && next;
         } else {
             lval_free(args);
-            lval_free(result);
-            lval_free(next);
             return lval_err("Internal reference error in builtin_compare_bool. Got %s.", func);
         }
-        lval_free(next);
     }
     lval_free(args);
-    return result;
+    return lval_bool(result);
 }
 
 // All types
@@ -232,7 +365,7 @@ lval *builtin_eq(lenv *env, lval *args) {
     }
     lval_free(control);
     lval_free(args);
-    return lval_num(eq_flag);
+    return lval_bool(eq_flag);
 }
 
 // Redefining neq so that it fits for multiple length args
@@ -244,24 +377,19 @@ lval *builtin_neq(lenv *env, lval *args) {
         return lval_err("Function '!=' must have at least one argument.");
     }
 
+    // Compare in place, no need to copy the remaining arguments
     int neq_flag = 1;
-    while ((args->count) && (neq_flag == 1)) {
-        lval *control = lval_pop(args, 0);
-        lval *remaining = lval_copy(args);
-        while (remaining->count) {
-            lval *next = lval_pop(remaining, 0);
-            if (lval_eq(control, next)) {
-                lval_free(next);
+    int i, j;
+    for (i = 0; (i < args->count) && (neq_flag == 1); i++) {
+        for (j = i + 1; j < args->count; j++) {
+            if (lval_eq(args->cell[i], args->cell[j])) {
                 neq_flag = 0;
                 break;
             }
-            lval_free(next);
         }
-        lval_free(control);
-        lval_free(remaining);
     }
     lval_free(args);
-    return lval_num(neq_flag);
+    return lval_bool(neq_flag);
 }
 
 lval *builtin_compare_num(lenv *env, lval *args, char *func) {
@@ -270,26 +398,23 @@ lval *builtin_compare_num(lenv *env, lval *args, char *func) {
     LASSERT_TYPE(args, func, 0, LVAL_NUM);
     LASSERT_TYPE(args, func, 1, LVAL_NUM);
 
-    lval *left = lval_pop(args, 0);
-    lval *right = lval_extract(args, 0);
+    long left = lval_num_value(args->cell[0]);
+    long right = lval_num_value(args->cell[1]);
+    lval_free(args);
     int result = 0;
     if (strcmp(func, ">") == 0) {
-        result = left->num > right->num;
+        result = left > right;
     } else if (strcmp(func, ">=") == 0) {
-        result = left->num >= right->num;
+        result = left >= right;
     } else if (strcmp(func, "<") == 0) {
-        result = left->num < right->num;
+        result = left < right;
     } else if (strcmp(func, "<=") == 0) {
-        result = left->num <= right->num;
+        result = left <= right;
     } else {
-        lval_free(left);
-        lval_free(right);
         return lval_err("Internal reference error in builtin_compare. Got %s.", func);
     }
 
-    lval_free(left);
-    lval_free(right);
-    return lval_num(result);
+    return lval_bool(result);
 }
 
 lval *builtin_greater(lenv *env, lval *args) {
@@ -326,32 +451,28 @@ lval *builtin_negate(lenv *env, lval *args) {
     lval *value = lval_extract(args, 0);
     int negation = lval_bool_value(value) ? 0 : 1;
     lval_free(value);
-    return lval_num(negation);
+    return lval_bool(negation);
 }
 
 // Simulate ternary operator
 lval *builtin_if(lenv *env, lval *args) {
 
     LASSERT_NUM(args, "if", 3);
-    if (args->cell[0]->type == LVAL_NUM) {
+    if (lval_type(args->cell[0]) == LVAL_NUM) {
         // Convert to bool
-        args->cell[0]->num = lval_bool_value(args->cell[0]);
-        args->cell[0]->type = LVAL_BOOL;
+        lval *condition = args->cell[0];
+        args->cell[0] = lval_bool(lval_bool_value(condition));
+        lval_free(condition);
     }
     LASSERT_TYPE(args, "if", 0, LVAL_BOOL);
     LASSERT_TYPE(args, "if", 1, LVAL_QEXPR);
     LASSERT_TYPE(args, "if", 2, LVAL_QEXPR);
 
-    lval *result;
-    if (args->cell[0]->num) {
-        args->cell[1]->type = LVAL_SEXPR; // Allow evaluation
-        result = lval_eval(env, lval_pop(args, 1));
-    } else {
-        args->cell[2]->type = LVAL_SEXPR;
-        result = lval_eval(env, lval_pop(args, 2));
-    }
+    // Branch may still be bound to a variable, so unshare before retyping
+    lval *branch = lval_unshare(lval_pop(args, lval_num_value(args->cell[0]) ? 1 : 2));
+    branch->type = LVAL_SEXPR; // Allow evaluation
     lval_free(args);
-    return result;
+    return lval_eval(env, branch);
 }
 
 
@@ -398,10 +519,8 @@ lval *builtin_head(lenv *env, lval *args) {
     LASSERT_TYPE(args, "head", 0, LVAL_QEXPR);
     LASSERT_NOT_EMPTY(args, "head", 0);
 
-    lval *value = lval_extract(args, 0);
-    // Free all elements except head
-    while (value->count > 1) { lval_free(lval_pop(value, 1)); }
-    return value;
+    lval *list = lval_extract(args, 0);
+    return lval_slice(list, 0, 1);
 }
 
 lval *builtin_tail(lenv *env, lval *args) {
@@ -413,9 +532,7 @@ lval *builtin_tail(lenv *env, lval *args) {
     LASSERT_NOT_EMPTY(args, "tail", 0);
 
     lval *list = lval_extract(args, 0);
-    // Free only first element
-    lval_free(lval_pop(list, 0));
-    return list;
+    return lval_slice(list, 1, list->count - 1);
 }
 
 lval *builtin_list(lenv *env, lval *args) {
@@ -431,7 +548,7 @@ lval *builtin_eval(lenv *env, lval *args) {
     lval_check_get_replace(env, args->cell[0]);
     LASSERT_TYPE(args, "eval", 0, LVAL_QEXPR);
 
-    lval *list = lval_extract(args, 0);
+    lval *list = lval_unshare(lval_extract(args, 0));
     list->type = LVAL_SEXPR;
     return lval_eval_sexpr(env, list);
 }
@@ -461,8 +578,8 @@ lval *builtin_cons(lenv *env, lval *args) {
     LASSERT_TYPE(args, "cons", 1, LVAL_QEXPR);
 
     lval *value = lval_pop(args, 0);
-    lval *list = lval_extract(args, 0);
-    return lval_insert(list, value, 0);
+    lval *list = lval_unshare(lval_extract(args, 0));
+    return lval_insert_move(list, value, 0);
 }
 
 lval *builtin_len(lenv *env, lval *args) {
@@ -483,10 +600,10 @@ lval *builtin_init(lenv *env, lval *args) {
     LASSERT_NUM(args, "init", 1);
     lval_check_get_replace(env, args->cell[0]);
     LASSERT_TYPE(args, "init", 0, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY(args, "init", 0);
 
     lval *list = lval_extract(args, 0);
-    lval_free(lval_pop(list, list->count - 1));
-    return list;
+    return lval_slice(list, 0, list->count - 1);
 }
 
 lval *builtin_op(lenv *env, lval *args, char *op) {
@@ -498,106 +615,75 @@ lval *builtin_op(lenv *env, lval *args, char *op) {
         LASSERT_TYPE(args, op, i, LVAL_NUM);
     }
 
-    lval *result = lval_pop(args, 0);
+    // Numbers are immediate, so accumulate in a plain long and only
+    // construct the result lval at the end
+    long result = lval_num_value(args->cell[0]);
     // Unary negation operator
-    if ((strcmp(op, "-") == 0) && args->count == 0) {
-        result->num *= -1;
+    if ((strcmp(op, "-") == 0) && args->count == 1) {
+        result *= -1;
     }
 
-    while (args->count > 0) {
-        lval *next = lval_pop(args, 0);
+    for (i = 1; i < args->count; i++) {
+        long next = lval_num_value(args->cell[i]);
 
         // num can only be up to LONG_MAX
         if (strcmp(op, "+") == 0) {
-            if (((result->num > 0)&&(next->num > 0)) || \
-                    ((result->num < 0)&&(next->num < 0))) {
-                if ((LONG_MAX - abs(result->num)) < abs(next->num)) {
-                    lval_free(result); // result freed before creating err lval
-                    lval_free(next); // next must be freed from same scope
-                    result = lval_err("Integer overflow");
-                    break;
-                }
+            if (((result > 0)&&(next > 0)) || \
+                    ((result < 0)&&(next < 0))) {
+                LASSERT(args, (LONG_MAX - abs(result)) >= abs(next),
+                    "Integer overflow");
             }
-            result->num += next->num;
+            result += next;
         }
         if (strcmp(op, "-") == 0) {
-            if (((result->num > 0)&&(next->num < 0)) || \
-                    ((result->num < 0)&&(next->num > 0))) {
-                if ((LONG_MAX - abs(result->num)) < abs(next->num)) {
-                    lval_free(result);
-                    lval_free(next);
-                    result = lval_err("Integer overflow");
-                    break;
-                }
+            if (((result > 0)&&(next < 0)) || \
+                    ((result < 0)&&(next > 0))) {
+                LASSERT(args, (LONG_MAX - abs(result)) >= abs(next),
+                    "Integer overflow");
             }
-            result->num -= next->num;
+            result -= next;
         }
         if (strcmp(op, "*") == 0) {
-            if (next->num != 0) {
-                if (abs(result->num) > (LONG_MAX/abs(next->num))) {
-                    lval_free(result);
-                    lval_free(next);
-                    result = lval_err("Integer overflow");
-                    break;
-                }
+            if (next != 0) {
+                LASSERT(args, abs(result) <= (LONG_MAX/abs(next)),
+                    "Integer overflow");
             }
-            result->num *= next->num;
+            result *= next;
         }
         if (strcmp(op, "/") == 0) {
-            if (next->num == 0) {
-                lval_free(result);
-                lval_free(next);
-                result = lval_err("Division by zero");
-                break;
-            }
-            result->num /= next->num;
+            LASSERT(args, next != 0, "Division by zero");
+            result /= next;
         }
 
         if (strcmp(op, "%") == 0) {
-            if (next->num == 0) {
-                lval_free(result);
-                lval_free(next);
-                result = lval_err("Division by zero");
-                break;
-            }
-            result->num %= next->num;
+            LASSERT(args, next != 0, "Division by zero");
+            result %= next;
         }
         if (strcmp(op, "^") == 0) {
-            if (next->num < 0) {
-                lval_free(result);
-                result = lval_err("Negative exponent (%d) not supported", next->num);
-                lval_free(next);
-                break;
-            }
+            LASSERT(args, next >= 0,
+                "Negative exponent (%ld) not supported", next);
             long exp_result = 1; // Note 0^0 is defined as 1
-            if (result->num == 0) {
-                if (next->num != 0) {
+            if (result == 0) {
+                if (next != 0) {
                     exp_result = 0; // ^ 0 1 evaluates to 0, not 1
                 }
             } else {
-                for (; next->num > 0; next->num--) {
-                    if (abs(exp_result) > (LONG_MAX/abs(result->num))) {
-                        lval_free(result);
-                        lval_free(next);
-                        result = lval_err("Integer overflow");
-                        break;
-                    }
-                    exp_result *= result->num;
+                for (; next > 0; next--) {
+                    LASSERT(args, abs(exp_result) <= (LONG_MAX/abs(result)),
+                        "Integer overflow");
+                    exp_result *= result;
                 }
             }
-            result->num = exp_result;
+            result = exp_result;
         }
 
         if (strcmp(op, "min") == 0) {
-            result->num = (result->num < next->num)
-                ? result->num : next->num;
+            result = (result < next) ? result : next;
         }
         if (strcmp(op, "max") == 0) {
-            result->num = (result->num > next->num)
-                ? result->num : next->num;
+            result = (result > next) ? result : next;
         }
-        lval_free(next);
     }
     lval_free(args);
-    return result;
+    return lval_num(result);
 }
@@ -1,5 +1,14 @@
 #include "lang_set.h"
 
+mpc_parser_t *Number;
+mpc_parser_t *Symbol;
+mpc_parser_t *String;
+mpc_parser_t *Comment;
+mpc_parser_t *Sexpr;
+mpc_parser_t *Qexpr;
+mpc_parser_t *Expr;
+mpc_parser_t *Lispy;
+
 // Approach to add new features to language:
 // 1. Syntax: Add new rule to grammar
 // 2. Representation: Add new data type variation
@@ -10,15 +19,15 @@
 // Arguments are evaluated via different set of rules
 parser_set_t *polish_notation_set(void) {
 
-    // Parsers
-    mpc_parser_t *Number = mpc_new("number");
-    mpc_parser_t *Symbol = mpc_new("symbol");
-    mpc_parser_t *String = mpc_new("string");
-    mpc_parser_t *Comment = mpc_new("comment");
-    mpc_parser_t *Sexpr = mpc_new("sexpr");
-    mpc_parser_t *Qexpr = mpc_new("qexpr");
-    mpc_parser_t *Expr = mpc_new("expr");
-    mpc_parser_t *Lispy = mpc_new("lispy");
+    // Parsers, kept global for loading function
+    Number = mpc_new("number");
+    Symbol = mpc_new("symbol");
+    String = mpc_new("string");
+    Comment = mpc_new("comment");
+    Sexpr = mpc_new("sexpr");
+    Qexpr = mpc_new("qexpr");
+    Expr = mpc_new("expr");
+    Lispy = mpc_new("lispy");
 
     // Why does "%%" nor '%%' work here?
     // Why does '%' work even though it is a flag? Direct str reading?
@@ -33,7 +42,7 @@ parser_set_t *polish_notation_set(void) {
             sexpr  : '(' <expr>* ')' ;                         \
             qexpr  : '{' <expr>* '}' ;                         \
             expr   : <number> | <symbol> | <string>            \
-                   | <sexpr> | <qexpr> ; \
+                   | <comment> | <sexpr> | <qexpr> ;           \
             lispy  : /^/ <expr>* /$/ ;                         \
         ",
         Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
@@ -0,0 +1,470 @@
+#include <stdint.h>
+
+#include "lval_alloc.h"
+#include "lval_lenv.h" // For LVAL_NODE_SIZE and LVAL_TAG_MASK
+
+// Freed slots are poisoned under AddressSanitizer, so use-after-free is
+// still caught even though the memory never goes back to malloc.
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#define LALLOC_POISON(ptr, size) ASAN_POISON_MEMORY_REGION(ptr, size)
+#define LALLOC_UNPOISON(ptr, size) ASAN_UNPOISON_MEMORY_REGION(ptr, size)
+#else
+#define LALLOC_POISON(ptr, size) ((void) 0)
+#define LALLOC_UNPOISON(ptr, size) ((void) 0)
+#endif
+
+// Each page starts with a link to the next page of the same pool,
+// padded so that slots keep malloc alignment
+#define LALLOC_PAGE_HEADER 16
+
+// Node pages carry their own bookkeeping, and are aligned to their size so
+// a node can find its page
+typedef struct lpage {
+    struct lpage *next; // next page of the same pool
+    char *bump; // first slot never handed out since the last reset
+    void *free_list; // freed slots of this page
+    long live;
+    struct lpage *spare_next; // neighbours on the empty or half-free list
+    struct lpage *spare_prev;
+} lpage;
+
+#define LPAGE_HEADER ((sizeof(lpage) + 15) / 16 * 16)
+#define LPAGE_OF(node) \
+    ((lpage *) ((uintptr_t) (node) & ~(uintptr_t) (LALLOC_PAGE_SIZE - 1)))
+#define LPAGE_FIRST(page) ((char *) (page) + LPAGE_HEADER)
+#define LPAGE_LAST(pool, page) ((char *) (page) + LALLOC_PAGE_SIZE - (pool)->size)
+#define LPAGE_SLOTS(pool) ((long) ((LALLOC_PAGE_SIZE - LPAGE_HEADER) / (pool)->size))
+
+#ifdef _WIN32
+#include <malloc.h>
+#define lpage_alloc() _aligned_malloc(LALLOC_PAGE_SIZE, LALLOC_PAGE_SIZE)
+#else
+#define lpage_alloc() aligned_alloc(LALLOC_PAGE_SIZE, LALLOC_PAGE_SIZE)
+#endif
+
+// Each pool is sized for its own member of the lval union
+static lpool node_pools[LPOOL_NODE_COUNT] = {
+    { "number", LVAL_NODE_SIZE(num), LVAL_NODE_HEADER },
+    { "error", LVAL_NODE_SIZE(err), LVAL_NODE_HEADER },
+    { "symbol", LVAL_NODE_SIZE(sym), LVAL_NODE_HEADER },
+    { "string", LVAL_NODE_SIZE(str), LVAL_NODE_HEADER },
+    { "function", LVAL_NODE_SIZE(body), LVAL_NODE_HEADER },
+    { "expression", LVAL_NODE_SIZE(small), LVAL_NODE_HEADER },
+};
+
+// Node pointers keep their low bits clear for immediate tagging (see
+// LVAL_TAG_MASK): slots sit a whole number of slot sizes past the page
+// header of an aligned page
+_Static_assert(_Alignof(lval) > LVAL_TAG_MASK, "lval alignment too small for tagging");
+_Static_assert((LPAGE_HEADER & LVAL_TAG_MASK) == 0, "page header breaks node alignment");
+_Static_assert(((LVAL_NODE_SIZE(num) | LVAL_NODE_SIZE(err) | LVAL_NODE_SIZE(sym)
+    | LVAL_NODE_SIZE(str) | LVAL_NODE_SIZE(body) | LVAL_NODE_SIZE(small))
+    & LVAL_TAG_MASK) == 0, "node size breaks node alignment");
+
+static lpool size_classes[] = {
+    { "data 8", 8 },
+    { "data 16", 16 },
+    { "data 32", 32 },
+    { "data 64", 64 },
+    { "data 128", 128 },
+    { "data 256", 256 },
+    { "data 512", 512 },
+};
+#define LALLOC_CLASS_COUNT (sizeof(size_classes) / sizeof(lpool))
+
+// Requests above LALLOC_MAX_CLASS bypass the slabs
+static long large_live_bytes = 0;
+static long large_peak_bytes = 0;
+
+int lquota_active = 0;
+static lquota quotas[LQUOTA_MAX] = { { "global", 0, 0, 0 } };
+static int quota_count = 1;
+
+static void lquota_charge(long bytes) {
+    lquota *quota = &quotas[lquota_active];
+    quota->current += bytes;
+    if (quota->current > quota->peak) { quota->peak = quota->current; }
+}
+
+// Free list link of a slot, stored just past the part kept intact
+#define LPOOL_LINK(pool, slot) (*(void **) ((char *) (slot) + (pool)->header))
+
+static void lpool_grow(lpool *pool) {
+    /* Allocate a fresh page and thread its slots onto the free list */
+    char *page = calloc(1, LALLOC_PAGE_SIZE);
+    if (page == NULL) {
+        printf("Memory failure during page allocation!\n");
+        exit(1);
+    }
+    *(void **) page = pool->pages;
+    pool->pages = page;
+    pool->page_count++;
+
+    char *slot = page + LALLOC_PAGE_HEADER;
+    char *end = page + LALLOC_PAGE_SIZE - pool->size;
+    for (; slot <= end; slot += pool->size) {
+        LPOOL_LINK(pool, slot) = pool->free_list;
+        pool->free_list = slot;
+        LALLOC_POISON(slot + pool->header, pool->size - pool->header);
+    }
+}
+
+static void *lpool_alloc(lpool *pool) {
+    if (pool->free_list == NULL) { lpool_grow(pool); }
+
+    void *slot = pool->free_list;
+    LALLOC_UNPOISON(slot, pool->size);
+    pool->free_list = LPOOL_LINK(pool, slot);
+
+    pool->total++;
+    if (++pool->live > pool->peak) { pool->peak = pool->live; }
+    return slot;
+}
+
+static void lpool_free(lpool *pool, void *slot) {
+    LPOOL_LINK(pool, slot) = pool->free_list;
+    pool->free_list = slot;
+    LALLOC_POISON((char *) slot + pool->header, pool->size - pool->header);
+    pool->live--;
+}
+
+// Index of smallest size class that fits, or -1 if too large
+static int lalloc_class(size_t size) {
+    int i;
+    for (i = 0; i < (int) LALLOC_CLASS_COUNT; i++) {
+        if (size <= size_classes[i].size) { return i; }
+    }
+    return -1;
+}
+
+/* NODE PAGES */
+
+static void lpage_reset(lpage *page) {
+    page->bump = LPAGE_FIRST(page);
+    page->free_list = NULL;
+    page->live = 0;
+}
+
+static lpage *lpage_new(lpool *pool) {
+    lpage *page = lpage_alloc();
+    if (page == NULL) {
+        printf("Memory failure during page allocation!\n");
+        exit(1);
+    }
+    page->next = pool->pages;
+    pool->pages = page;
+    pool->page_count++;
+    lpage_reset(page);
+    LALLOC_POISON(LPAGE_FIRST(page), LALLOC_PAGE_SIZE - LPAGE_HEADER);
+    return page;
+}
+
+// Retired pages are kept on one of two lists of their pool as their live
+// count drops: the half-free list once at most half the slots are live,
+// and the empty list once none are. The current page is on neither.
+static void lpage_push(lpage **list, lpage *page) {
+    page->spare_prev = NULL;
+    page->spare_next = *list;
+    if (*list) { (*list)->spare_prev = page; }
+    *list = page;
+}
+
+static void lpage_unlink(lpage **list, lpage *page) {
+    if (page->spare_prev) {
+        page->spare_prev->spare_next = page->spare_next;
+    } else {
+        *list = page->spare_next;
+    }
+    if (page->spare_next) { page->spare_next->spare_prev = page->spare_prev; }
+}
+
+static lpage *lpage_next(lpool *pool) {
+    /* Pick the page to allocate from once the current one is full */
+    // An emptied page is reset and reused whole. Failing that, a retired
+    // page is only taken back once at least half of it has been freed, so
+    // a page left with a few survivors is not revisited for every node.
+    lpage *page = pool->empty;
+    if (page) {
+        lpage_unlink((lpage **) &pool->empty, page);
+        lpage_reset(page);
+        pool->recycled++;
+        return page;
+    }
+    page = pool->partial;
+    if (page) {
+        lpage_unlink((lpage **) &pool->partial, page);
+        return page;
+    }
+    return lpage_new(pool);
+}
+
+void *lalloc_node(int index) {
+    /* Take a node from the current page, its own free slots first */
+    lpool *pool = &node_pools[index];
+    lpage *page = pool->current;
+    if (page == NULL || (page->free_list == NULL && page->bump > LPAGE_LAST(pool, page))) {
+        page = pool->current = lpage_next(pool);
+    }
+
+    void *slot;
+    if (page->free_list) {
+        slot = page->free_list;
+        LALLOC_UNPOISON(slot, pool->size);
+        page->free_list = LPOOL_LINK(pool, slot);
+    } else {
+        slot = page->bump;
+        page->bump += pool->size;
+        LALLOC_UNPOISON(slot, pool->size);
+    }
+
+    page->live++;
+    pool->total++;
+    if (++pool->live > pool->peak) { pool->peak = pool->live; }
+    lquota_charge(pool->size);
+    return slot;
+}
+
+void lfree_node(void *node, int index) {
+    lpool *pool = &node_pools[index];
+    lpage *page = LPAGE_OF(node);
+    LPOOL_LINK(pool, node) = page->free_list;
+    page->free_list = node;
+    LALLOC_POISON((char *) node + pool->header, pool->size - pool->header);
+    page->live--;
+    pool->live--;
+    lquota_charge(-(long) pool->size);
+
+    if (page == pool->current) { return; }
+    if (page->live == 0) {
+        lpage_unlink((lpage **) &pool->partial, page);
+        lpage_push((lpage **) &pool->empty, page);
+    } else if (page->live == LPAGE_SLOTS(pool) / 2) {
+        lpage_push((lpage **) &pool->partial, page);
+    }
+}
+
+void lalloc_each_node(void (*visit)(void *)) {
+    /* Call visit on every slot handed out since its page was last reset */
+    int i;
+    for (i = 0; i < LPOOL_NODE_COUNT; i++) {
+        lpool *pool = &node_pools[i];
+        lpage *page;
+        for (page = pool->pages; page; page = page->next) {
+            char *slot;
+            for (slot = LPAGE_FIRST(page); slot < page->bump; slot += pool->size) {
+                visit(slot);
+            }
+        }
+    }
+}
+
+/* ARENA PAGES */
+
+void *lalloc_arena_node(int index) {
+    /* Bump allocate a node from the arena, or NULL once the arena is full */
+    lpool *pool = &node_pools[index];
+    lpage *page = pool->arena_current;
+    if (page == NULL || page->bump > LPAGE_LAST(pool, page)) {
+        // Pages kept from earlier forms are reused before adding new ones
+        if (page && page->next) {
+            page = page->next;
+        } else if (page == NULL && pool->arena) {
+            page = pool->arena;
+        } else {
+            if (pool->arena_page_count == LALLOC_ARENA_PAGES) { return NULL; }
+            lpage *fresh = lpage_alloc();
+            if (fresh == NULL) { return NULL; }
+            lpage_reset(fresh);
+            fresh->next = NULL;
+            LALLOC_POISON(LPAGE_FIRST(fresh), LALLOC_PAGE_SIZE - LPAGE_HEADER);
+            if (page) { page->next = fresh; } else { pool->arena = fresh; }
+            pool->arena_page_count++;
+            page = fresh;
+        }
+        pool->arena_current = page;
+    }
+
+    void *slot = page->bump;
+    page->bump += pool->size;
+    LALLOC_UNPOISON(slot, pool->size);
+    pool->total++;
+    return slot;
+}
+
+void lalloc_arena_each(void (*visit)(void *)) {
+    /* Call visit on every node allocated from the arena since the last reset */
+    int i;
+    for (i = 0; i < LPOOL_NODE_COUNT; i++) {
+        lpool *pool = &node_pools[i];
+        lpage *page;
+        for (page = pool->arena; page; page = page->next) {
+            char *slot;
+            for (slot = LPAGE_FIRST(page); slot < page->bump; slot += pool->size) {
+                visit(slot);
+            }
+            if (page == pool->arena_current) { break; }
+        }
+    }
+}
+
+void lalloc_arena_reset(void) {
+    /* Empty the arena, keeping its pages for the next form */
+    int i;
+    for (i = 0; i < LPOOL_NODE_COUNT; i++) {
+        lpool *pool = &node_pools[i];
+        lpage *page;
+        for (page = pool->arena; page; page = page->next) {
+            LALLOC_POISON(LPAGE_FIRST(page), page->bump - LPAGE_FIRST(page));
+            page->bump = LPAGE_FIRST(page);
+            if (page == pool->arena_current) { break; }
+        }
+        pool->arena_current = NULL;
+    }
+}
+
+long lalloc_live_nodes(void) {
+    long live = 0;
+    int i;
+    for (i = 0; i < LPOOL_NODE_COUNT; i++) { live += node_pools[i].live; }
+    return live;
+}
+
+void *lalloc(size_t size) {
+    if (size == 0) { return NULL; }
+    int index = lalloc_class(size);
+    if (index >= 0) {
+        lquota_charge(size_classes[index].size);
+        return lpool_alloc(&size_classes[index]);
+    }
+
+    lquota_charge(size);
+    large_live_bytes += size;
+    if (large_live_bytes > large_peak_bytes) { large_peak_bytes = large_live_bytes; }
+    return malloc(size);
+}
+
+void lfree(void *ptr, size_t size) {
+    if (ptr == NULL) { return; }
+    int index = lalloc_class(size);
+    if (index >= 0) {
+        lquota_charge(-(long) size_classes[index].size);
+        lpool_free(&size_classes[index], ptr);
+        return;
+    }
+    lquota_charge(-(long) size);
+    large_live_bytes -= size;
+    free(ptr);
+}
+
+void *lrealloc(void *ptr, size_t old_size, size_t new_size) {
+    /* Resize a sized allocation, staying put when the class is unchanged */
+    if (ptr == NULL) { return lalloc(new_size); }
+    if (new_size == 0) {
+        lfree(ptr, old_size);
+        return NULL;
+    }
+
+    int old_index = lalloc_class(old_size);
+    int new_index = lalloc_class(new_size);
+    if (old_index >= 0 && old_index == new_index) { return ptr; }
+    if (old_index < 0 && new_index < 0) {
+        lquota_charge((long) new_size - (long) old_size);
+        large_live_bytes += new_size - old_size;
+        if (large_live_bytes > large_peak_bytes) { large_peak_bytes = large_live_bytes; }
+        return realloc(ptr, new_size);
+    }
+
+    void *resized = lalloc(new_size);
+    memcpy(resized, ptr, old_size < new_size ? old_size : new_size);
+    lfree(ptr, old_size);
+    return resized;
+}
+
+char *lalloc_strdup(char *str) {
+    char *copy = lalloc(strlen(str) + 1);
+    strcpy(copy, str);
+    return copy;
+}
+
+static void lpool_print_stats(lpool *pool) {
+    printf(" %-12s %6zu %9ld %9ld %11ld %6ld\n", pool->name, pool->size,
+        pool->live, pool->peak, pool->total, pool->page_count);
+}
+
+void lalloc_print_stats(void) {
+    /* Print live and peak slot counts of every pool */
+    printf(" %-12s %6s %9s %9s %11s %6s\n",
+        "pool", "size", "live", "peak", "total", "pages");
+    int i;
+    for (i = 0; i < LPOOL_NODE_COUNT; i++) {
+        lpool_print_stats(&node_pools[i]);
+    }
+    for (i = 0; i < (int) LALLOC_CLASS_COUNT; i++) {
+        lpool_print_stats(&size_classes[i]);
+    }
+    printf(" %-12s %6s %9ld %9ld (bytes)\n", "large", "-",
+        large_live_bytes, large_peak_bytes);
+
+    long recycled = 0;
+    for (i = 0; i < LPOOL_NODE_COUNT; i++) { recycled += node_pools[i].recycled; }
+    printf(" %-12s %6s %9ld (node pages)\n", "recycled", "-", recycled);
+
+    long arena = 0;
+    for (i = 0; i < LPOOL_NODE_COUNT; i++) { arena += node_pools[i].arena_page_count; }
+    printf(" %-12s %6s %9ld (node pages)\n", "arena", "-", arena);
+}
+
+/* QUOTAS */
+
+// Index of the context called name, created with no limit if create is
+// set and there is room. Returns -1 if there is no such context.
+int lquota_find(char *name, int create) {
+    int i;
+    for (i = 0; i < quota_count; i++) {
+        if (strncmp(quotas[i].name, name, LQUOTA_NAME - 1) == 0) { return i; }
+    }
+    if (!create || quota_count == LQUOTA_MAX) { return -1; }
+
+    lquota *quota = &quotas[quota_count];
+    strncpy(quota->name, name, LQUOTA_NAME - 1);
+    quota->name[LQUOTA_NAME - 1] = '\0';
+    quota->limit = 0;
+    quota->current = 0;
+    quota->peak = 0;
+    return quota_count++;
+}
+
+void lquota_set_limit(int index, long limit) {
+    quotas[index].limit = limit;
+}
+
+int lquota_over(void) {
+    /* Whether the active context is past its limit */
+    lquota *quota = &quotas[lquota_active];
+    return quota->limit > 0 && quota->current > quota->limit;
+}
+
+// Move what lalloc charged for a block of size bytes from one context to
+// another, e.g. when a block is kept in a pool instead of being freed
+void lquota_move(size_t size, int from, int to) {
+    if (size == 0) { return; }
+    int index = lalloc_class(size);
+    long bytes = index >= 0 ? (long) size_classes[index].size : (long) size;
+    int active = lquota_active;
+    lquota_active = from;
+    lquota_charge(-bytes);
+    lquota_active = to;
+    lquota_charge(bytes);
+    lquota_active = active;
+}
+
+void lquota_print_stats(void) {
+    printf(" %-12s %11s %11s %11s\n", "quota", "limit", "current", "peak");
+    int i;
+    for (i = 0; i < quota_count; i++) {
+        lquota *quota = &quotas[i];
+        printf("%c%-12s %11ld %11ld %11ld\n", i == lquota_active ? '*' : ' ',
+            quota->name, quota->limit, quota->current, quota->peak);
+    }
+}
@@ -0,0 +1,90 @@
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "lval_defer.h"
+
+static pthread_mutex_t heap = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static int running = 0; // background thread started
+static atomic_int idle = 0; // main thread is waiting for input
+
+// Nodes whose last reference is gone, refcount 0 but not yet released
+// Mostly large lists, plus what is left of one after a slice.
+static lval **pending = NULL;
+static int pending_count = 0;
+static int pending_capacity = 0;
+
+static long deferred = 0;
+static long freed_background = 0;
+
+static void ldefer_queue(lval *value) {
+    if (pending_count == pending_capacity) {
+        pending_capacity = pending_capacity ? pending_capacity * 2 : 16;
+        pending = realloc(pending, sizeof(lval *) * pending_capacity);
+    }
+    pending[pending_count++] = value;
+}
+
+// Free queued lists until the main thread wants the heap back, checking
+// after every slice
+static void *ldefer_run(void *arg) {
+    pthread_mutex_lock(&heap);
+    while (1) {
+        while (!atomic_load(&idle) || pending_count == 0) {
+            pthread_cond_wait(&work, &heap);
+        }
+        freed_background += lval_reclaim_some(pending[--pending_count],
+            LDEFER_SLICE, ldefer_queue);
+    }
+    return NULL;
+}
+
+void ldefer_start(void) {
+    /* Take the heap for the main thread and start freeing in the background */
+    pthread_mutex_lock(&heap);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, ldefer_run, NULL) == 0) {
+        pthread_detach(thread);
+        running = 1;
+    }
+}
+
+// Queue value, whose refcount just dropped to 0, if it is worth deferring
+// Returns 0 if the caller must free it inline.
+int ldefer_push(lval *value) {
+    if (!running || pending_count >= LDEFER_MAX_PENDING) { return 0; }
+    if (value->type != LVAL_SEXPR && value->type != LVAL_QEXPR) { return 0; }
+    // Only count children the list releases itself, not a shared array
+    lvec *vec = value->vec;
+    if (vec == NULL || vec->refcount > 1 || vec->hi - vec->lo < LDEFER_MIN_CELLS) {
+        return 0;
+    }
+
+    ldefer_queue(value);
+    deferred++;
+    return 1;
+}
+
+void ldefer_drain(void) {
+    while (pending_count) { lval_reclaim(pending[--pending_count]); }
+}
+
+void ldefer_idle_begin(void) {
+    /* Hand the heap to the background thread, e.g. before readline */
+    if (!running) { return; }
+    atomic_store(&idle, 1);
+    pthread_cond_signal(&work);
+    pthread_mutex_unlock(&heap);
+}
+
+void ldefer_idle_end(void) {
+    /* Take the heap back, waiting for at most one slice to be freed */
+    if (!running) { return; }
+    atomic_store(&idle, 0);
+    pthread_mutex_lock(&heap);
+}
+
+void ldefer_print_stats(void) {
+    printf(" %-12s %6s %9d %9ld (pending, lists deferred), %ld nodes freed in background\n",
+        "deferred", "-", pending_count, deferred, freed_background);
+}
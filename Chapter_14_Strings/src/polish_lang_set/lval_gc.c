@@ -0,0 +1,229 @@
+#include "lval_gc.h"
+
+int lgc_call_depth = 0;
+
+// Growable array of lval pointers, used for roots and sweep bookkeeping
+typedef struct lgc_stack {
+    lval **items;
+    int count;
+    int capacity;
+} lgc_stack;
+
+static lgc_stack roots = { NULL, 0, 0 };
+static lgc_stack marking = { NULL, 0, 0 }; // explicit mark stack
+static lgc_stack garbage = { NULL, 0, 0 };
+
+static lenv **envs = NULL;
+static int env_count = 0;
+static int env_capacity = 0;
+
+static long growth = 0; // 0 disables automatic collection
+static long threshold = LGC_MIN_THRESHOLD;
+static int requested = 0;
+
+static long collections = 0; // also tags the cell arrays traced by each
+static long reclaimed_total = 0;
+static long reclaimed_last = 0;
+
+static void lgc_stack_push(lgc_stack *stack, lval *value) {
+    if (stack->count == stack->capacity) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 64;
+        stack->items = realloc(stack->items, sizeof(lval *) * stack->capacity);
+    }
+    stack->items[stack->count++] = value;
+}
+
+void lgc_push_root(lval *value) {
+    lgc_stack_push(&roots, value);
+}
+
+void lgc_pop_root(void) {
+    roots.count--;
+}
+
+void lgc_push_env(lenv *env) {
+    if (env_count == env_capacity) {
+        env_capacity = env_capacity ? env_capacity * 2 : 8;
+        envs = realloc(envs, sizeof(lenv *) * env_capacity);
+    }
+    envs[env_count++] = env;
+}
+
+void lgc_pop_env(void) {
+    env_count--;
+}
+
+/* MARK */
+
+static void lgc_mark_value(lval *value) {
+    if (lval_is_immediate(value) || (value->flags & (LVAL_FLAG_MARKED | LVAL_FLAG_IMMORTAL))) {
+        return;
+    }
+    value->flags |= LVAL_FLAG_MARKED;
+    lgc_stack_push(&marking, value);
+}
+
+static void lgc_mark_env(lenv *env) {
+    int i;
+    for (i = 0; i < env->count; i++) { lgc_mark_value(env->vals[i]); }
+}
+
+static void lgc_mark(void) {
+    int i;
+    collections++;
+    for (i = 0; i < roots.count; i++) { lgc_mark_value(roots.items[i]); }
+    // Interned nodes are kept alive by the table until purged
+    lintern_purge();
+    lintern_each(lgc_mark_value);
+    for (i = 0; i < env_count; i++) {
+        lenv *env;
+        for (env = envs[i]; env; env = env->parent) { lgc_mark_env(env); }
+    }
+
+    // Trace children iteratively rather than recursing on the C stack
+    while (marking.count) {
+        lval *value = marking.items[--marking.count];
+        switch (value->type) {
+            case LVAL_FUNC:
+                if (value->builtin == NULL) {
+                    lgc_mark_env(value->env);
+                    lgc_mark_value(value->formals);
+                    lgc_mark_value(value->body);
+                }
+                break;
+            case LVAL_SEXPR:
+            case LVAL_QEXPR:
+                if (value->vec) {
+                    // The whole array is kept alive by any slice of it
+                    lvec *vec = value->vec;
+                    if (vec->mark == (unsigned) collections) { break; }
+                    vec->mark = collections;
+                    for (i = vec->lo; i < vec->hi; i++) { lgc_mark_value(vec->items[i]); }
+                } else {
+                    for (i = 0; i < value->count; i++) { lgc_mark_value(value->cell[i]); }
+                }
+                break;
+        }
+    }
+}
+
+/* SWEEP */
+
+static void lgc_sweep_slot(void *slot) {
+    /* Clear marks on live nodes and collect allocated, unmarked ones */
+    lval *value = slot;
+    if (value->refcount == 0) { return; } // free slot
+    if (value->flags & LVAL_FLAG_MARKED) {
+        value->flags &= ~LVAL_FLAG_MARKED;
+        return;
+    }
+    value->flags |= LVAL_FLAG_GARBAGE;
+    lgc_stack_push(&garbage, value);
+}
+
+// Garbage referencing a live node still counts towards its refcount, so
+// give that reference back. References between garbage nodes are ignored.
+static void lgc_drop(lval *child) {
+    if (lval_is_immediate(child) || (child->flags & LVAL_FLAG_GARBAGE)) { return; }
+    lval_free(child);
+}
+
+static void lgc_drop_children(lval *value) {
+    int i;
+    switch (value->type) {
+        case LVAL_FUNC:
+            if (value->builtin == NULL) {
+                // Shared environments go with the last function using them
+                lenv *env = value->env;
+                if (--env->refcount == 0) {
+                    for (i = 0; i < env->count; i++) { lgc_drop(env->vals[i]); }
+                    lenv_release(env);
+                }
+                lgc_drop(value->formals);
+                lgc_drop(value->body);
+            }
+            break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            if (value->vec) {
+                // Shared cell arrays go with the last expression using them
+                lvec *vec = value->vec;
+                if (--vec->refcount > 0) { break; }
+                for (i = vec->lo; i < vec->hi; i++) { lgc_drop(vec->items[i]); }
+                lfree(vec, sizeof(lvec) + sizeof(lval *) * vec->capacity);
+            } else {
+                for (i = 0; i < value->count; i++) { lgc_drop(value->cell[i]); }
+            }
+            break;
+    }
+}
+
+static void lgc_release(lval *value) {
+    /* Free the storage of a garbage node, without touching its children */
+    lquota_active = value->quota;
+    switch (value->type) {
+        case LVAL_FUNC:
+            break; // any environment was handed back by lgc_drop_children
+        case LVAL_ERR: lfree(value->err, strlen(value->err) + 1); break;
+        case LVAL_SYM: break; // Names are interned
+        case LVAL_STR: lfree(value->str, strlen(value->str) + 1); break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            break; // any cell array was handed back by lgc_drop_children
+    }
+    value->refcount = 0;
+    value->flags = 0;
+    lfree_node(value, lval_pool(value->type));
+}
+
+long lgc_collect(void) {
+    /* Full mark and sweep, returns number of nodes reclaimed */
+    // Queued lists still hold references while reading as free slots
+    ldefer_drain();
+    lgc_mark();
+    garbage.count = 0;
+    lalloc_each_node(lgc_sweep_slot);
+
+    // All references out of garbage are dropped before any garbage is
+    // freed, so lgc_drop never looks at a slot that was already recycled
+    int i;
+    int active = lquota_active;
+    for (i = 0; i < garbage.count; i++) { lgc_drop_children(garbage.items[i]); }
+    for (i = 0; i < garbage.count; i++) { lgc_release(garbage.items[i]); }
+    lquota_active = active;
+
+    reclaimed_last = garbage.count;
+    reclaimed_total += garbage.count;
+    threshold = lalloc_live_nodes() * growth;
+    if (threshold < LGC_MIN_THRESHOLD) { threshold = LGC_MIN_THRESHOLD; }
+    return garbage.count;
+}
+
+void lgc_safepoint(void) {
+    /* Collect if requested or due, unless a function call is in progress */
+    if (lgc_call_depth > 0) { return; }
+    if (requested || (growth > 0 && lalloc_live_nodes() > threshold)) {
+        requested = 0;
+        lgc_collect();
+    }
+}
+
+void lgc_request(void) {
+    requested = 1;
+}
+
+void lgc_set_growth(long factor) {
+    growth = factor;
+    threshold = lalloc_live_nodes() * growth;
+    if (threshold < LGC_MIN_THRESHOLD) { threshold = LGC_MIN_THRESHOLD; }
+}
+
+void lgc_print_stats(void) {
+    printf(" collections %ld, reclaimed %ld (last %ld), live %ld, ",
+        collections, reclaimed_total, reclaimed_last, lalloc_live_nodes());
+    if (growth > 0) {
+        printf("growth %ld, threshold %ld\n", growth, threshold);
+    } else {
+        printf("automatic collection off\n");
+    }
+}
@@ -0,0 +1,327 @@
+#include "lval_intern.h"
+
+// Entries are kept in the order they were interned, which puts every
+// node after its children. slots indexes them by hash with linear
+// probing and holds -1 in empty slots.
+typedef struct lintern_entry {
+    lval *value;
+    unsigned long hash;
+} lintern_entry;
+
+static int enabled = 0;
+static lintern_entry *entries = NULL;
+static int entry_count = 0;
+static int *slots = NULL;
+static int slot_capacity = 0; // power of two, entries hold half as many
+
+static long lookups = 0;
+static long hits = 0;
+static long purged = 0;
+
+// Lists being interned, children first, walked without recursion
+typedef struct lintern_frame {
+    lval *list;
+    int index; // next child to intern
+} lintern_frame;
+
+static lintern_frame *frames = NULL;
+static int frame_count = 0;
+static int frame_capacity = 0;
+
+// Symbol names, open addressing with linear probing, NULL if empty
+static char **names = NULL;
+static int name_count = 0;
+static int name_capacity = 0; // power of two
+
+char *lsym_rest = NULL;
+char *lsym_dir = NULL;
+
+void lintern_set(int on) {
+    enabled = on;
+}
+
+/* HASHING */
+
+// FNV-1a step
+static unsigned long lintern_mix(unsigned long hash, unsigned long word) {
+    return (hash ^ word) * 16777619UL;
+}
+
+static unsigned long lintern_mix_str(unsigned long hash, char *str) {
+    while (*str) { hash = lintern_mix(hash, (unsigned char) *str++); }
+    return hash;
+}
+
+// Children are hashed by address, they are canonical already
+static unsigned long lintern_mix_ptr(unsigned long hash, lval *value) {
+    uintptr_t word = (uintptr_t) value;
+    return lintern_mix(hash, (unsigned long) (word ^ (word >> 4)));
+}
+
+static unsigned long lintern_hash(lval *value) {
+    unsigned long hash = lintern_mix(2166136261UL, value->type);
+    int i;
+    switch (value->type) {
+        case LVAL_NUM: hash = lintern_mix(hash, (unsigned long) value->num); break;
+        case LVAL_SYM:
+            hash = lintern_mix_ptr(hash, (lval *) value->sym);
+            hash = lintern_mix(hash, value->slot);
+            break;
+        case LVAL_STR: hash = lintern_mix_str(hash, value->str); break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            hash = lintern_mix(hash, value->count);
+            for (i = 0; i < value->count; i++) { hash = lintern_mix_ptr(hash, value->cell[i]); }
+            break;
+    }
+    return hash;
+}
+
+// Whether a and b hold the same contents, given canonical children
+static int lintern_same(lval *a, lval *b) {
+    if (a->type != b->type) { return 0; }
+    int i;
+    switch (a->type) {
+        case LVAL_NUM: return a->num == b->num;
+        case LVAL_SYM: return a->sym == b->sym && a->slot == b->slot;
+        case LVAL_STR: return strcmp(a->str, b->str) == 0;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            if (a->count != b->count) { return 0; }
+            for (i = 0; i < a->count; i++) {
+                if (a->cell[i] != b->cell[i]) { return 0; }
+            }
+            return 1;
+    }
+    return 0;
+}
+
+// Whether value, whose children are canonical, holds any slot hint
+static int lintern_hinted(lval *value) {
+    int i;
+    switch (value->type) {
+        case LVAL_SYM: return value->slot != 0;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            for (i = 0; i < value->count; i++) {
+                lval *child = value->cell[i];
+                if (!lval_is_immediate(child) && (child->flags & LVAL_FLAG_HINTED)) { return 1; }
+            }
+            break;
+    }
+    return 0;
+}
+
+static int lintern_canonical(lval *value) {
+    return lval_is_immediate(value) || (value->flags & LVAL_FLAG_INTERNED);
+}
+
+/* TABLE */
+
+static int lintern_fold(unsigned long hash, int capacity) {
+    return (int) ((hash ^ (hash >> 16)) & (unsigned long) (capacity - 1));
+}
+
+static int lintern_slot(unsigned long hash) {
+    return lintern_fold(hash, slot_capacity);
+}
+
+static void lintern_index(void) {
+    int i;
+    for (i = 0; i < slot_capacity; i++) { slots[i] = -1; }
+    for (i = 0; i < entry_count; i++) {
+        int slot = lintern_slot(entries[i].hash);
+        while (slots[slot] >= 0) { slot = (slot + 1) & (slot_capacity - 1); }
+        slots[slot] = i;
+    }
+}
+
+// Drop entries nothing but the table refers to
+// Walking backwards reaches a dead list before its children, so children
+// only it kept alive are found dead within the same pass.
+void lintern_purge(void) {
+    int i, kept = 0;
+    for (i = entry_count - 1; i >= 0; i--) {
+        if (entries[i].value->refcount == 1) {
+            lval_free(entries[i].value);
+            entries[i].value = NULL;
+            purged++;
+        }
+    }
+    for (i = 0; i < entry_count; i++) {
+        if (entries[i].value) { entries[kept++] = entries[i]; }
+    }
+    entry_count = kept;
+    if (slot_capacity) { lintern_index(); }
+}
+
+// Make room for one more entry
+// A full table is purged first and only grows if that leaves it over a
+// quarter full, so purging costs amortised O(1) per entry.
+static void lintern_reserve(void) {
+    if ((entry_count + 1) * 2 <= slot_capacity) { return; }
+    lintern_purge();
+    while ((entry_count + 1) * 4 > slot_capacity) {
+        slot_capacity = slot_capacity ? slot_capacity * 2 : 64;
+    }
+    slots = realloc(slots, sizeof(int) * slot_capacity);
+    entries = realloc(entries, sizeof(lintern_entry) * (slot_capacity / 2));
+    lintern_index();
+}
+
+// Canonical node for value, whose children are already interned
+// Takes ownership of value and returns the node to keep in its place.
+static lval *lintern_node(lval *value) {
+    int i;
+    switch (value->type) {
+        case LVAL_NUM:
+        case LVAL_SYM:
+        case LVAL_STR:
+            break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            for (i = 0; i < value->count; i++) {
+                if (!lintern_canonical(value->cell[i])) { return value; }
+            }
+            break;
+        default:
+            return value;
+    }
+
+    lookups++;
+    unsigned long hash = lintern_hash(value);
+    if (slot_capacity) {
+        int slot;
+        for (slot = lintern_slot(hash); slots[slot] >= 0; slot = (slot + 1) & (slot_capacity - 1)) {
+            lintern_entry *entry = &entries[slots[slot]];
+            if (entry->hash == hash && lintern_same(entry->value, value)) {
+                hits++;
+                lval_free(value);
+                return lval_ref(entry->value);
+            }
+        }
+    }
+
+    lintern_reserve();
+    int slot = lintern_slot(hash);
+    while (slots[slot] >= 0) { slot = (slot + 1) & (slot_capacity - 1); }
+    slots[slot] = entry_count;
+    entries[entry_count].value = lval_ref(value);
+    entries[entry_count].hash = hash;
+    entry_count++;
+    value->flags |= LVAL_FLAG_INTERNED;
+    if (lintern_hinted(value)) { value->flags |= LVAL_FLAG_HINTED; }
+    return value;
+}
+
+static void lintern_push(lval *list) {
+    if (frame_count == frame_capacity) {
+        frame_capacity = frame_capacity ? frame_capacity * 2 : 64;
+        frames = realloc(frames, sizeof(lintern_frame) * frame_capacity);
+    }
+    frames[frame_count].list = list;
+    frames[frame_count].index = 0;
+    frame_count++;
+}
+
+// Take a private list whose children can be replaced in place
+static lval *lintern_open(lval *list) {
+    list = lval_unshare(list);
+    lval_own_cells(list);
+    lintern_push(list);
+    return list;
+}
+
+// Shared, canonical version of value if interning is on
+// Takes ownership of value and returns the value to keep in its place.
+// Scratch values are promoted first, the table only holds heap nodes.
+lval *lintern_value(lval *value) {
+    if (!enabled || lintern_canonical(value)) { return value; }
+    value = lval_promote(value);
+    if (value->type != LVAL_SEXPR && value->type != LVAL_QEXPR) {
+        return lintern_node(value);
+    }
+
+    // Copies made on the way must not land in the arena either
+    int open = lval_arena_suspend();
+    int base = frame_count;
+    lval *result = lintern_open(value);
+    while (frame_count > base) {
+        lintern_frame *frame = &frames[frame_count - 1];
+        lval *list = frame->list;
+
+        if (frame->index == list->count) {
+            // All children done, replace the list in its parent's slot
+            result = lintern_node(list);
+            frame_count--;
+            if (frame_count > base) {
+                frame = &frames[frame_count - 1];
+                frame->list->cell[frame->index++] = result;
+            }
+            continue;
+        }
+
+        lval *child = list->cell[frame->index];
+        if (lintern_canonical(child)) {
+            frame->index++;
+        } else if (child->type == LVAL_SEXPR || child->type == LVAL_QEXPR) {
+            int index = frame->index; // frames may move when pushing
+            list->cell[index] = lintern_open(child);
+        } else {
+            list->cell[frame->index++] = lintern_node(child);
+        }
+    }
+    lval_arena_resume(open);
+    return result;
+}
+
+void lintern_each(void (*visit)(lval *)) {
+    int i;
+    for (i = 0; i < entry_count; i++) { visit(entries[i].value); }
+}
+
+void lintern_print_stats(void) {
+    printf(" interning %s: %d nodes, %ld of %ld lookups shared, %ld purged\n",
+        enabled ? "on" : "off", entry_count, hits, lookups, purged);
+}
+
+/* SYMBOL NAMES */
+
+static void lintern_grow_names(void) {
+    int capacity = name_capacity ? name_capacity * 2 : 256;
+    char **grown = calloc(capacity, sizeof(char *));
+    int i;
+    for (i = 0; i < name_capacity; i++) {
+        if (names[i] == NULL) { continue; }
+        int slot = lintern_fold(lintern_mix_str(2166136261UL, names[i]), capacity);
+        while (grown[slot]) { slot = (slot + 1) & (capacity - 1); }
+        grown[slot] = names[i];
+    }
+    free(names);
+    names = grown;
+    name_capacity = capacity;
+}
+
+// The one copy of name, added to the table if it is new
+char *lintern_sym(char *name) {
+    if (name_capacity == 0) {
+        lintern_grow_names();
+        lsym_rest = lintern_sym("&");
+        lsym_dir = lintern_sym("dir");
+    }
+    if ((name_count + 1) * 2 > name_capacity) { lintern_grow_names(); }
+
+    int slot = lintern_fold(lintern_mix_str(2166136261UL, name), name_capacity);
+    for (; names[slot]; slot = (slot + 1) & (name_capacity - 1)) {
+        if (strcmp(names[slot], name) == 0) { return names[slot]; }
+    }
+    lsym_name *entry = malloc(sizeof(lsym_name) + strlen(name) + 1);
+    entry->bindings = 0;
+    entry->global_slot = -1;
+    entry->global = NULL;
+    entry->builtin = NULL;
+    entry->constant = NULL;
+    names[slot] = strcpy(entry->text, name);
+    name_count++;
+    return names[slot];
+}
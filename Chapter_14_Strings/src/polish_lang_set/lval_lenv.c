@@ -9,6 +9,10 @@
  */
 
 #include "lval_lenv.h"
+#include "lval_alloc.h"
+#include "lval_gc.h"
+#include "lval_intern.h"
+#include "lval_defer.h"
 #include "builtin.h" // For builtin_eval in lval_call()
 
 // Guide has a better idea to pass enum values itself
@@ -26,33 +30,88 @@ char *lval_type_name(int enum_value) {
     return "Unknown";
 }
 
+// Slab pool that nodes of each lval type are allocated from
+int lval_pool(int type) {
+    switch (type) {
+        case LVAL_NUM: return LPOOL_NUM;
+        case LVAL_ERR: return LPOOL_ERR;
+        case LVAL_SYM: return LPOOL_SYM;
+        case LVAL_STR: return LPOOL_STR;
+        case LVAL_FUNC: return LPOOL_FUNC;
+    }
+    return LPOOL_LIST;
+}
+
+static int arena_mode = 0; // arena builtin
+static int arena_open = 0; // a top-level form is allocating from the arena
+
+// Growable stack of pending nodes
+// Traversals of nested values (free, promote, eq, print) keep their work
+// here rather than recursing, so nesting depth is bounded by the heap and
+// not by the C stack. Each traversal works above the count it started at.
+typedef struct lval_stack {
+    lval **items;
+    int count;
+    int capacity;
+} lval_stack;
+
+static lval_stack free_stack = { NULL, 0, 0 };
+static lval_stack promote_stack = { NULL, 0, 0 };
+static lval_stack eq_stack = { NULL, 0, 0 };
+static lval_stack resolve_stack = { NULL, 0, 0 };
+static int freeing = 0; // free_stack is being drained
+
+static void lval_stack_push(lval_stack *stack, lval *value) {
+    if (stack->count == stack->capacity) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 64;
+        stack->items = realloc(stack->items, sizeof(lval *) * stack->capacity);
+    }
+    stack->items[stack->count++] = value;
+}
+
+static lval *lval_new(int type) {
+    lval *value;
+    if (arena_open && (value = lalloc_arena_node(lval_pool(type)))) {
+        value->flags = LVAL_FLAG_SCRATCH | LVAL_FLAG_ARENA;
+    } else {
+        // Nodes that overflow a full arena are still scratch
+        value = lalloc_node(lval_pool(type));
+        value->flags = arena_open ? LVAL_FLAG_SCRATCH : 0;
+    }
+    value->type = type;
+    value->quota = lquota_active;
+    value->slot = 0;
+    value->refcount = 1;
+    return value;
+}
+
 // Num lval constructor
+// Returns an immediate fixnum, only boxing numbers too wide to fit
 lval *lval_num(long result) {
-    lval *value = malloc(sizeof(lval));
-    value->type = LVAL_NUM;
+    if (result >= LVAL_FIXNUM_MIN && result <= LVAL_FIXNUM_MAX) {
+        return (lval *) (((uintptr_t) (intptr_t) result << 1) | LVAL_TAG_FIXNUM);
+    }
+    lval *value = lval_new(LVAL_NUM);
     value->num = result;
     return value;
 }
 
+// Booleans are always immediate
 lval *lval_bool(char boolean) {
-    lval *value = malloc(sizeof(lval));
-    value->type = LVAL_BOOL;
-    value->num = boolean ? 1 : 0;
-    return value;
+    return (lval *) (uintptr_t) (LVAL_TAG_BOOL | (boolean ? 0x4 : 0));
 }
 
 // Error lval constructor
 lval *lval_err(char *format, ...) {
-    lval *value = malloc(sizeof(lval));
-    value->type = LVAL_ERR;
+    lval *value = lval_new(LVAL_ERR);
 
     va_list va;
     va_start(va, format);
-    value->err = malloc(512);
+    char buffer[512];
 
-    // copy formatted string to value->err, then resize
-    vsnprintf(value->err, 511, format, va);
-    value->err = realloc(value->err, strlen(value->err)+1);
+    // format into buffer, then copy only what is needed to value->err
+    vsnprintf(buffer, 511, format, va);
+    value->err = lalloc_strdup(buffer);
     va_end(va);
 
     return value;
@@ -60,68 +119,243 @@ lval *lval_err(char *format, ...) {
 
 // Symbol lval constructor
 lval *lval_sym(char *symbol_str) {
-    lval *value = malloc(sizeof(lval));
-    value->type = LVAL_SYM;
-    value->sym = malloc(strlen(symbol_str) + 1);
-    strcpy(value->sym, symbol_str);
+    lval *value = lval_new(LVAL_SYM);
+    value->sym = lintern_sym(symbol_str);
     return value;
 }
 
 lval *lval_str(char *str) {
-    lval *value = malloc(sizeof(lval));
-    value->type = LVAL_STR;
-    value->str = malloc(strlen(str) + 1);
-    strcpy(value->str, str);
+    lval *value = lval_new(LVAL_STR);
+    value->str = lalloc_strdup(str);
     return value;
 }
 
 // Adjusted functions to share name in sym slot
 lval *lval_func(lbuiltin func) {
-    lval *value = malloc(sizeof(lval));
-    value->type = LVAL_FUNC;
+    lval *value = lval_new(LVAL_FUNC);
     value->builtin = func;
     return value;
 }
 
+// Formal position of sym once bound, counting from 1, or 0 if not a formal
+static int lval_formal_slot(lval *formals, char *sym) {
+    int i, slot = 0;
+    for (i = 0; i < formals->count && slot < UCHAR_MAX; i++) {
+        if (formals->cell[i]->sym == lsym_rest) { continue; } // & takes no slot
+        slot++;
+        if (formals->cell[i]->sym == sym) { return slot; }
+    }
+    return 0;
+}
+
+// Resolve symbols in body naming a formal to the slot it is bound to
+// Arguments are bound in order, so the nth formal is the nth binding of
+// the call's environment. Scope is dynamic, though: a body can also be
+// run where that does not hold (by eval, a nested function, a local =),
+// and only the frame of the call itself is known in advance. The slot is
+// therefore just a hint that lenv_get checks before relying on it.
+//
+// The body may share nodes with a literal still bound elsewhere or with
+// the intern table, and those must not change under their other holders.
+// Lists are resolved on private copies, and a symbol whose hint changes
+// is copied first. Takes ownership of body and returns the resolved body
+// to keep in its place.
+static lval *lval_resolve_sym(lval *formals, lval *sym) {
+    int slot = lval_formal_slot(formals, sym->sym);
+    if (sym->slot == slot) { return sym; }
+    sym = lval_unshare(sym);
+    sym->slot = slot;
+    return sym;
+}
+
+static lval *lval_resolve_open(lval *list) {
+    list = lval_unshare(list);
+    lval_own_cells(list);
+    return list;
+}
+
+static lval *lval_resolve(lval *formals, lval *body) {
+    if (lval_is_immediate(body)) { return body; }
+    if (body->type == LVAL_SYM) { return lval_resolve_sym(formals, body); }
+    if (body->type != LVAL_SEXPR && body->type != LVAL_QEXPR) { return body; }
+
+    body = lval_resolve_open(body);
+    int base = resolve_stack.count;
+    lval_stack_push(&resolve_stack, body);
+    while (resolve_stack.count > base) {
+        lval *list = resolve_stack.items[--resolve_stack.count];
+        int i;
+        for (i = 0; i < list->count; i++) {
+            lval *child = list->cell[i];
+            if (lval_is_immediate(child)) { continue; }
+            switch (child->type) {
+                case LVAL_SYM:
+                    list->cell[i] = lval_resolve_sym(formals, child);
+                    break;
+                case LVAL_SEXPR:
+                case LVAL_QEXPR:
+                    if (child->count == 0) { break; } // Nothing to resolve
+                    list->cell[i] = lval_resolve_open(child);
+                    lval_stack_push(&resolve_stack, list->cell[i]);
+                    break;
+            }
+        }
+    }
+    return body;
+}
+
 lval *lval_lambda(lval *formals, lval* body) {
-    lval *value = malloc(sizeof(lval));
-    value->type = LVAL_FUNC;
+    lval *value = lval_new(LVAL_FUNC);
     value->builtin = NULL; // User-defined functions are not builtin functions
 
     value->env = lenv_new(); // Local scope for arguments
-    value->formals = formals; // Lambda arguments
-    value->body = body; // Qexpr function definition
+    value->env->scratch = value->flags & LVAL_FLAG_SCRATCH;
+    value->formals = lintern_value(formals); // Lambda arguments
+    // Qexpr function definition
+    value->body = lintern_value(lval_resolve(value->formals, body));
     return value;
 }
 
 // Sexpr lval constructor
 lval *lval_sexpr(void) {
-    lval *value = malloc(sizeof(lval));
-    value->type = LVAL_SEXPR;
+    lval *value = lval_new(LVAL_SEXPR);
     value->count = 0;
-    value->cell = NULL;
+    value->front = 0;
+    value->cell = value->small;
+    value->vec = NULL;
     return value;
 }
 
+// The empty S-expression returned by builtins with nothing to return
+// One immortal node is shared by all of them: lval_ref and lval_free
+// ignore it, and its refcount never reads 1, so copy on write never
+// modifies it in place.
+static lval empty_sexpr = {
+    .type = LVAL_SEXPR, .flags = LVAL_FLAG_IMMORTAL, .refcount = 2,
+    .count = 0, .front = 0, .cell = empty_sexpr.small, .vec = NULL
+};
+
+lval *lval_empty(void) {
+    return &empty_sexpr;
+}
+
 // Qexpr lval constructor
 lval *lval_qexpr(void) {
-    lval *value = malloc(sizeof(lval));
-    value->type = LVAL_QEXPR;
+    lval *value = lval_new(LVAL_QEXPR);
     value->count = 0;
-    value->cell = NULL;
+    value->front = 0;
+    value->cell = value->small;
+    value->vec = NULL;
     return value;
 }
 
+static lvec *lvec_new(int capacity) {
+    lvec *vec = lalloc(sizeof(lvec) + sizeof(lval *)*capacity);
+    vec->refcount = 1;
+    vec->capacity = capacity;
+    vec->lo = 0;
+    vec->hi = 0;
+    vec->mark = 0;
+    return vec;
+}
+
+void lvec_free(lvec *vec) {
+    if (--vec->refcount > 0) { return; }
+    int i;
+    for (i = vec->lo; i < vec->hi; i++) { lval_free(vec->items[i]); }
+    lfree(vec, sizeof(lvec) + sizeof(lval *)*(vec->capacity));
+}
+
+// Whether list holds the references to its own children
+static int lval_owns_cells(lval *list) {
+    lvec *vec = list->vec;
+    return vec == NULL || (vec->refcount == 1
+        && vec->lo == list->front && vec->hi == list->front + list->count);
+}
+
+// Point list at fresh storage, holding count children from cells
+// Up to LVAL_SMALL_CELLS children live inside the node itself, larger
+// lists get a cell array of their own from the size classes
+static void lval_set_cells(lval *list, lval **cells, int count, int capacity) {
+    if (capacity <= LVAL_SMALL_CELLS) {
+        memmove(list->small, cells, sizeof(lval *)*count);
+        list->vec = NULL;
+        list->cell = list->small;
+    } else {
+        list->vec = lvec_new(capacity);
+        list->vec->hi = count;
+        memcpy(list->vec->items, cells, sizeof(lval *)*count);
+        list->cell = list->vec->items;
+    }
+    list->count = count;
+    list->front = 0;
+}
+
+// Move the children of list to the start of a new cell array
+static void lval_move_cells(lval *list, int capacity) {
+    lvec *old = list->vec;
+    lval_set_cells(list, list->cell, list->count, capacity);
+    if (old) {
+        old->hi = old->lo; // references moved over
+        lvec_free(old);
+    }
+}
+
+// Give list storage of its own before modifying it
+// A list viewing a slice of a shared cell array copies its children out
+void lval_own_cells(lval *list) {
+    if (lval_owns_cells(list)) { return; }
+    lvec *old = list->vec;
+    int i;
+    for (i = 0; i < list->count; i++) { lval_ref(list->cell[i]); }
+    lval_set_cells(list, list->cell, list->count, list->count);
+    lvec_free(old);
+}
+
+// Make room for count children
+// Slots popped off the front are reused by sliding the children back once
+// they make up half of the array, otherwise the array doubles
+static void lval_reserve(lval *list, int count) {
+    lval_own_cells(list);
+    int capacity = LVAL_CAPACITY(list);
+    if (list->front + count <= capacity) { return; }
+    if (count <= capacity
+        && (list->front >= capacity / 2 || LVAL_CELLS_INLINE(list))) {
+        lval_move_cells(list, capacity);
+        return;
+    }
+    lval_move_cells(list, count > capacity * 2 ? count : capacity * 2);
+}
+
+// Halve the array once the list is down to a quarter of it, so that
+// alternating adds and pops never resize back and forth
+static void lval_trim(lval *list) {
+    if (!lval_owns_cells(list)) { return; }
+    if (list->count == 0) {
+        list->cell -= list->front;
+        list->front = 0;
+        if (list->vec) { list->vec->lo = list->vec->hi = 0; }
+    }
+    int capacity = LVAL_CAPACITY(list);
+    if (capacity > LVAL_SMALL_CELLS && list->count <= capacity / 4) {
+        lval_move_cells(list, capacity / 2);
+    }
+}
+
 // Append to sexpr list
 lval *lval_add(lval *list, lval *node) {
+    lval_reserve(list, list->count + 1);
     list->count++;
-    list->cell = realloc(list->cell, (list->count)*sizeof(lval *));
     list->cell[list->count-1] = node;
+    if (list->vec) { list->vec->hi++; }
     return list;
 }
 
-// Free memory allocated to lval value based on type
-void lval_free(lval *value) {
+// Drop a reference to value
+// Memory allocated to lval value is freed based on type once the last
+// reference is gone
+static void lval_release(lval *value) {
+    /* Drop everything value holds, leaving the node itself */
     switch (value->type) {
         case LVAL_FUNC:
             if (value->builtin == NULL) {
@@ -132,60 +366,195 @@ void lval_free(lval *value) {
             break;
         case LVAL_BOOL:
         case LVAL_NUM: break;
-        case LVAL_ERR: free(value->err); break;
-        case LVAL_SYM: free(value->sym); break;
-        case LVAL_STR: free(value->str); break;
+        case LVAL_ERR: lfree(value->err, strlen(value->err) + 1); break;
+        case LVAL_SYM: break; // Names are interned
+        case LVAL_STR: lfree(value->str, strlen(value->str) + 1); break;
         case LVAL_QEXPR:
         case LVAL_SEXPR: {
+            if (value->vec) {
+                lvec_free(value->vec);
+                break;
+            }
             int i;
             for (i = 0; i < value->count; i++) {
                 lval_free(value->cell[i]);
             }
-            free(value->cell);
             break;
         }
     }
-    free(value);
+}
+
+void lval_free(lval *value) {
+    if (lval_is_immediate(value) || (value->flags & LVAL_FLAG_IMMORTAL)) { return; }
+    if (--value->refcount > 0) { return; }
+    if (value->flags & LVAL_FLAG_ARENA) { return; } // Released with the arena
+    if (ldefer_push(value)) { return; } // Large lists are freed in the background
+    lval_reclaim(value);
+}
+
+// Release a node whose last reference is gone, along with its storage
+void lval_reclaim(lval *value) {
+    lval_stack_push(&free_stack, value);
+
+    // Children dropped by lval_release come back through lval_free and are
+    // queued on the same stack, to be released by the outermost call
+    if (freeing) { return; }
+    freeing = 1;
+    int active = lquota_active;
+    while (free_stack.count) {
+        lval *dead = free_stack.items[--free_stack.count];
+        lquota_active = dead->quota; // Credit whoever allocated it
+        lval_release(dead);
+        lfree_node(dead, lval_pool(dead->type));
+    }
+    lquota_active = active;
+    freeing = 0;
+}
+
+// lval_reclaim in slices of at most budget nodes
+// Nodes the slice did not get to, refcount 0 but not yet released, are
+// handed to spill. Returns how many nodes were released.
+long lval_reclaim_some(lval *value, long budget, void (*spill)(lval *)) {
+    lval_stack_push(&free_stack, value);
+    freeing = 1;
+    int active = lquota_active;
+    long released = 0;
+    while (free_stack.count && released < budget) {
+        lval *dead = free_stack.items[--free_stack.count];
+        lquota_active = dead->quota;
+        lval_release(dead);
+        lfree_node(dead, lval_pool(dead->type));
+        released++;
+    }
+    while (free_stack.count) { spill(free_stack.items[--free_stack.count]); }
+    lquota_active = active;
+    freeing = 0;
+    return released;
 }
 
 lval *lval_pop(lval *list, int index) {
-    lval *result = list->cell[index];
-    // Protects agianst segfault
-    if (list->count != index + 1) {
-        memmove(&(list->cell[index]), &(list->cell[index+1]),
-            sizeof(lval *)*(list->count-index-1)); // pop value->cell[index]
+    lval *result;
+    if (index == 0) {
+        // Popping the head only moves the front of the list, O(1), and
+        // leaves a shared cell array untouched
+        result = list->cell[0];
+        if (!lval_owns_cells(list)) {
+            lval_ref(result);
+        } else if (list->vec) {
+            list->vec->lo++;
+        }
+        list->cell++;
+        list->front++;
+    } else {
+        lval_own_cells(list);
+        result = list->cell[index];
+        // Protects agianst segfault
+        if (list->count != index + 1) {
+            memmove(&(list->cell[index]), &(list->cell[index+1]),
+                sizeof(lval *)*(list->count-index-1)); // pop value->cell[index]
+        }
+        if (list->vec) { list->vec->hi--; }
     }
     list->count--;
-    list->cell = realloc(list->cell, sizeof(lval *)*(list->count));
+    lval_trim(list);
     return result;
 }
 
 // General form of lval_add
-// Will this cause segfault if list->count == index?
+// Stores its own reference to value, the caller keeps (and frees) theirs
 lval *lval_insert(lval *list, lval *value, int index) {
-    list->cell = realloc(list->cell, sizeof(lval *)*(list->count + 1));
-    // Protects against segfault when appending
-    if (list->count != index){
-        memmove(&(list->cell[index+1]), &(list->cell[index]),
-            sizeof(lval *)*(list->count-index));
+    return lval_insert_move(list, lval_ref(value), index);
+}
+
+// lval_insert taking over the caller's reference to value
+lval *lval_insert_move(lval *list, lval *value, int index) {
+    if (index == 0 && list->front > 0 && lval_owns_cells(list)) {
+        // Prepend into a slot freed by an earlier pop
+        list->cell--;
+        list->front--;
+        if (list->vec) { list->vec->lo--; }
+    } else {
+        lval_reserve(list, list->count + 1);
+        // Protects against segfault when appending
+        if (list->count != index){
+            memmove(&(list->cell[index+1]), &(list->cell[index]),
+                sizeof(lval *)*(list->count-index));
+        }
+        if (list->vec) { list->vec->hi++; }
     }
     list->count++;
     list->cell[index] = value;
-    lval_free(value);
     return list;
 }
 
+// Children start to start + count - 1 of list, taking ownership of list
+// A shared list is sliced in O(1) by viewing its cell array, or copying
+// at most LVAL_SMALL_CELLS children when they are stored inline.
+lval *lval_slice(lval *list, int start, int count) {
+    int i;
+    if (list->refcount == 1) {
+        // Narrow the list in place, dropping the children left out
+        if (lval_owns_cells(list)) {
+            for (i = 0; i < start; i++) { lval_free(list->cell[i]); }
+            for (i = start + count; i < list->count; i++) { lval_free(list->cell[i]); }
+            if (list->vec) {
+                list->vec->lo = list->front + start;
+                list->vec->hi = list->front + start + count;
+            }
+        }
+        list->cell += start;
+        list->front += start;
+        list->count = count;
+        lval_trim(list);
+        return list;
+    }
+
+    lval *slice = lval_new(list->type);
+    slice->count = count;
+    if (list->vec) {
+        slice->vec = list->vec;
+        slice->vec->refcount++;
+        slice->front = list->front + start;
+        slice->cell = slice->vec->items + slice->front;
+    } else {
+        slice->vec = NULL;
+        slice->front = 0;
+        slice->cell = slice->small;
+        for (i = 0; i < count; i++) { slice->cell[i] = lval_ref(list->cell[start + i]); }
+    }
+    lval_free(list);
+    return slice;
+}
+
+// Take another reference to value, O(1) regardless of its size
+lval *lval_ref(lval *value) {
+    if (!lval_is_immediate(value) && !(value->flags & LVAL_FLAG_IMMORTAL)) {
+        value->refcount++;
+    }
+    return value;
+}
+
+// Fresh, unshared node with the same contents as value
+// Only the top level is duplicated: children are shared by reference,
+// and are themselves copied on write if ever modified.
 lval *lval_copy(lval *value) {
-    lval *copy = malloc(sizeof(lval));
-    copy->type = value->type;
+    if (lval_is_immediate(value)) { return value; }
+    lval *copy = lval_new(value->type);
 
     switch (value->type) {
         case LVAL_FUNC:
             if (value->builtin == NULL) {
                 copy->builtin = NULL;
-                copy->env = lenv_copy(value->env);
-                copy->formals = lval_copy(value->formals);
-                copy->body = lval_copy(value->body);
+                // Copies share the environment, unless moving in or out
+                // of scratch changes whether its values get promoted
+                if (!(copy->flags & LVAL_FLAG_SCRATCH) == !value->env->scratch) {
+                    copy->env = lenv_ref(value->env);
+                } else {
+                    copy->env = lenv_copy(value->env);
+                    copy->env->scratch = copy->flags & LVAL_FLAG_SCRATCH;
+                }
+                copy->formals = lval_ref(value->formals);
+                copy->body = lval_ref(value->body);
             } else {
                 copy->builtin = value->builtin;
             }
@@ -193,73 +562,207 @@ lval *lval_copy(lval *value) {
         case LVAL_BOOL:
         case LVAL_NUM: copy->num = value->num; break;
         case LVAL_ERR:
-            copy->err = malloc(strlen(value->err) + 1);
-            strcpy(copy->err, value->err);
+            copy->err = lalloc_strdup(value->err);
             break;
         case LVAL_SYM:
-            copy->sym = malloc(strlen(value->sym) + 1);
-            strcpy(copy->sym, value->sym);
+            copy->sym = value->sym;
+            copy->slot = value->slot;
             break;
         case LVAL_STR:
-            copy->str = malloc(strlen(value->str) + 1);
-            strcpy(copy->str, value->str);
+            copy->str = lalloc_strdup(value->str);
             break;
         case LVAL_SEXPR:
         case LVAL_QEXPR:
-            copy->count = value->count;
-            copy->cell = malloc(sizeof(lval *) * copy->count);
+            lval_set_cells(copy, value->cell, value->count, value->count);
             int i;
             for (i = 0; i < copy->count; i++) {
-                copy->cell[i] = lval_copy(value->cell[i]);
+                lval_ref(copy->cell[i]);
             }
             break;
     }
     return copy;
 }
 
-// Check strict equality of lvals, by comparing addresses
-// Strings are treated as primitives, and same primitive values are equal
-// Returns bool in the form of 0 and 1
+// Copy on write: returns value itself if the caller holds the only
+// reference, otherwise trades the caller's reference for a private copy
+lval *lval_unshare(lval *value) {
+    if (lval_is_immediate(value) || value->refcount == 1) { return value; }
+    lval *copy = lval_copy(value);
+    lval_free(value); // Not the last reference, or immortal
+    return copy;
+}
 
-// Modifying defintion to include suggested idea:
-// All fields should be equal!
-// And simply return an int will do, no point keeping it as lval since
-// it is not a builtin function anyway.
-// This method really leverages on recursion. Sounds like an aspect I need to improve in.
-int lval_eq(lval *lval1, lval *lval2) {
+void lval_set_arena(int on) {
+    arena_mode = on;
+}
 
-    if (lval1->type != lval2->type) { return 0; }
+// Start allocating a top-level form from the arena
+// Returns 0 if arena mode is off or a form is already running in it, in
+// which case the caller must not call lval_arena_end.
+int lval_arena_begin(void) {
+    if (!arena_mode || arena_open) { return 0; }
+    arena_open = 1;
+    return 1;
+}
 
-    switch (lval1->type) {
+// Allocate from the pools even while a form runs in the arena
+// Returns the state to hand back to lval_arena_resume.
+int lval_arena_suspend(void) {
+    int open = arena_open;
+    arena_open = 0;
+    return open;
+}
+
+void lval_arena_resume(int open) {
+    arena_open = open;
+}
+
+static void lval_arena_release(void *slot) {
+    int active = lquota_active;
+    lquota_active = ((lval *) slot)->quota;
+    lval_release(slot);
+    lquota_active = active;
+}
+
+void lval_arena_end(void) {
+    /* Give back what arena nodes hold outside the arena, then empty it */
+    // Arena nodes are never freed one by one, whatever their refcount,
+    // so every node still holds its strings, cell array and references
+    arena_open = 0;
+    lalloc_arena_each(lval_arena_release);
+    lalloc_arena_reset();
+}
+
+// Copy a scratch value out to the heap so it can outlive its form
+// Takes ownership of value and returns the value to keep in its place.
+// Children are promoted too, values that are not scratch are kept as is.
+static lval *lval_promote_node(lval *value) {
+    lval *copy = lval_copy(value);
+    lval_free(value);
+    lval_stack_push(&promote_stack, copy);
+    return copy;
+}
+
+lval *lval_promote(lval *value) {
+    if (lval_is_immediate(value) || !(value->flags & LVAL_FLAG_SCRATCH)) { return value; }
+    int open = lval_arena_suspend();
+
+    // Each copy is queued to have its own scratch children promoted
+    int base = promote_stack.count;
+    lval *result = lval_promote_node(value);
+    while (promote_stack.count > base) {
+        lval *copy = promote_stack.items[--promote_stack.count];
+        lval **slots[2] = { NULL, NULL };
+        int i, count = 0;
+        switch (copy->type) {
+            case LVAL_FUNC:
+                if (copy->builtin == NULL) {
+                    for (i = 0; i < copy->env->count; i++) {
+                        lval *child = copy->env->vals[i];
+                        if (!lval_is_immediate(child) && (child->flags & LVAL_FLAG_SCRATCH)) {
+                            copy->env->vals[i] = lval_promote_node(child);
+                        }
+                    }
+                    slots[0] = &copy->formals;
+                    slots[1] = &copy->body;
+                    count = 2;
+                }
+                break;
+            case LVAL_SEXPR:
+            case LVAL_QEXPR:
+                for (i = 0; i < copy->count; i++) {
+                    lval *child = copy->cell[i];
+                    if (!lval_is_immediate(child) && (child->flags & LVAL_FLAG_SCRATCH)) {
+                        copy->cell[i] = lval_promote_node(child);
+                    }
+                }
+                break;
+        }
+        for (i = 0; i < count; i++) {
+            lval *child = *slots[i];
+            if (!lval_is_immediate(child) && (child->flags & LVAL_FLAG_SCRATCH)) {
+                *slots[i] = lval_promote_node(child);
+            }
+        }
+    }
+
+    lval_arena_resume(open);
+    return result;
+}
+
+// Compare the nodes themselves, queueing their children on eq_stack
+static int lval_eq_node(lval *lval1, lval *lval2) {
+
+    if (lval1 == lval2) { return 1; } // Shared node or identical immediate
+    if (lval_type(lval1) != lval_type(lval2)) { return 0; }
+    // Interned nodes are unique, so distinct ones always differ, unless
+    // they only differ in slot hints
+    if (!lval_is_immediate(lval1) && !lval_is_immediate(lval2)
+        && (lval1->flags & lval2->flags & LVAL_FLAG_INTERNED)
+        && !((lval1->flags | lval2->flags) & LVAL_FLAG_HINTED)) { return 0; }
+
+    switch (lval_type(lval1)) {
         case LVAL_FUNC:
             if (lval1->builtin || lval2->builtin) {
                 return lval1->builtin == lval2->builtin;
             }
-            return lval_eq(lval1->formals, lval2->formals)
-                && lval_eq(lval1->body, lval2->body);
+            lval_stack_push(&eq_stack, lval1->formals);
+            lval_stack_push(&eq_stack, lval2->formals);
+            lval_stack_push(&eq_stack, lval1->body);
+            lval_stack_push(&eq_stack, lval2->body);
+            return 1;
         case LVAL_BOOL:
-        case LVAL_NUM: return lval1->num == lval2->num;
+        case LVAL_NUM: return lval_num_value(lval1) == lval_num_value(lval2);
         case LVAL_ERR: return (strcmp(lval1->err, lval2->err) == 0);
-        case LVAL_SYM: return (strcmp(lval1->sym, lval2->sym) == 0);
+        case LVAL_SYM: return lval1->sym == lval2->sym;
         case LVAL_STR: return (strcmp(lval1->str, lval2->str) == 0);
         case LVAL_SEXPR:
         case LVAL_QEXPR: // Compares addresses
             if (lval1->count != lval2->count) { return 0; }
             int i;
-            for (i = 0; i < lval1->count; i++) {
-                if (!lval_eq(lval1->cell[i], lval2->cell[i])) { return 0; }
+            for (i = lval1->count - 1; i >= 0; i--) {
+                lval_stack_push(&eq_stack, lval1->cell[i]);
+                lval_stack_push(&eq_stack, lval2->cell[i]);
             }
             return 1;
     }
     return 0;
 }
 
+// Check strict equality of lvals, by comparing addresses
+// Strings are treated as primitives, and same primitive values are equal
+// Returns bool in the form of 0 and 1
+
+// Modifying defintion to include suggested idea:
+// All fields should be equal!
+// And simply return an int will do, no point keeping it as lval since
+// it is not a builtin function anyway.
+// Nested lists are compared from an explicit stack of pairs rather than
+// by recursion, so deeply nested values cannot overflow the C stack.
+int lval_eq(lval *lval1, lval *lval2) {
+
+    // Pairs still to compare are pushed two at a time
+    int base = eq_stack.count;
+    lval_stack_push(&eq_stack, lval1);
+    lval_stack_push(&eq_stack, lval2);
+
+    while (eq_stack.count > base) {
+        lval2 = eq_stack.items[--eq_stack.count];
+        lval1 = eq_stack.items[--eq_stack.count];
+        if (!lval_eq_node(lval1, lval2)) {
+            eq_stack.count = base;
+            return 0;
+        }
+    }
+    return 1;
+}
+
 // Check bool value of lval, and returns an int 0 or 1
 // Only 0, () and {} return false
 int lval_bool_value(lval *value) {
-    switch(value->type) {
+    switch(lval_type(value)) {
         case LVAL_BOOL:
-        case LVAL_NUM: return value->num ? 1 : 0;
+        case LVAL_NUM: return lval_num_value(value) ? 1 : 0;
         case LVAL_SEXPR:
         case LVAL_QEXPR: return value->count != 0;
     }
@@ -269,8 +772,12 @@ int lval_bool_value(lval *value) {
 lval *lval_join(lval *list, lval *next) {
     /* Concatenates two qexpr */
     // Note qexpr and sexpr share same list attribute, i.e. lval_add
-    while (next->count) {
-        list = lval_add(list, lval_pop(next, 0));
+    // next is only read, so its elements are shared rather than moved
+    list = lval_unshare(list);
+    lval_reserve(list, list->count + next->count);
+    int i;
+    for (i = 0; i < next->count; i++) {
+        list = lval_add(list, lval_ref(next->cell[i]));
     }
 
     lval_free(next);
@@ -280,7 +787,7 @@ lval *lval_join(lval *list, lval *next) {
 // This is not required during evaluation... why...?
 // Probably because the evaluation is already done in lval_eval itself...
 void lval_check_get_replace(lenv *env, lval *src) {
-    if (src->type == LVAL_SYM) {
+    if (lval_type(src) == LVAL_SYM) {
         lval_get_replace(env, src);
     }
 }
@@ -299,34 +806,71 @@ lval *lval_extract(lval *list, int index) {
     return result;
 }
 
-void lval_expr_print(lval *expr, char open, char close) {
-    putchar(open);
-    int i;
-    for (i = 0; i < expr->count; i++) {
-        lval_print(expr->cell[i]);
-        if (i != (expr->count -1)) putchar(' ');
-    }
-    putchar(close);
-}
+// Expression or lambda being printed, and its next child to print
+typedef struct lval_print_frame {
+    lval *value;
+    int index;
+} lval_print_frame;
 
-void lval_print(lval *value) {
-    switch (value->type) {
+static lval_print_frame *print_frames = NULL;
+static int print_count = 0;
+static int print_capacity = 0;
+
+static int lval_print_open(lval *value) {
+    /* Print an atom whole or the start of a nested value, 1 if nested */
+    switch (lval_type(value)) {
         case LVAL_BOOL:
-        case LVAL_NUM: printf("%li", value->num); break;
+        case LVAL_NUM: printf("%li", lval_num_value(value)); break;
         case LVAL_ERR: printf("Error: %s", value->err); break;
         case LVAL_SYM: printf("%s", value->sym); break;
         case LVAL_STR: lval_print_str(value); break;
             // To escape characters since they are encoded..., '\', 'n', ...
         case LVAL_FUNC:
             if (value->builtin == NULL) {
-                printf("(\\ "); lval_print(value->formals);
-                putchar(' '); lval_print(value->body); putchar(')');
-            } else {
-                printf("<builtin>");
+                printf("(\\ ");
+                return 1;
             }
+            printf("<builtin>");
             break;
-        case LVAL_SEXPR: lval_expr_print(value, '(', ')'); break;
-        case LVAL_QEXPR: lval_expr_print(value, '{', '}'); break;
+        case LVAL_SEXPR: putchar('('); return 1;
+        case LVAL_QEXPR: putchar('{'); return 1;
+    }
+    return 0;
+}
+
+// Children of a lambda are its formals and body
+static lval *lval_print_child(lval *value, int index) {
+    if (value->type == LVAL_FUNC) {
+        if (index == 0) { return value->formals; }
+        return index == 1 ? value->body : NULL;
+    }
+    return index < value->count ? value->cell[index] : NULL;
+}
+
+static void lval_print_push(lval *value) {
+    if (print_count == print_capacity) {
+        print_capacity = print_capacity ? print_capacity * 2 : 64;
+        print_frames = realloc(print_frames, sizeof(lval_print_frame) * print_capacity);
+    }
+    print_frames[print_count++] = (lval_print_frame) { value, 0 };
+}
+
+// Nested values are printed from a stack of frames instead of recursing
+void lval_print(lval *value) {
+    if (!lval_print_open(value)) { return; }
+    int base = print_count;
+    lval_print_push(value);
+
+    while (print_count > base) {
+        lval_print_frame *frame = &print_frames[print_count - 1];
+        lval *child = lval_print_child(frame->value, frame->index);
+        if (child == NULL) {
+            putchar(frame->value->type == LVAL_QEXPR ? '}' : ')');
+            print_count--;
+            continue;
+        }
+        if (frame->index++ > 0) { putchar(' '); }
+        if (lval_print_open(child)) { lval_print_push(child); }
     }
 }
 
@@ -398,22 +942,23 @@ lval *lval_read(mpc_ast_t *node) {
         if (strcmp(node->children[i]->tag, "regex") == 0) continue;
         list = lval_add(list, lval_read(node->children[i]));
     }
+    if (list->type == LVAL_QEXPR) { list = lintern_value(list); }
     return list;
 }
 
 // Evaluation
 lval *lval_eval(lenv *env, lval *value) {
-    if (value->type == LVAL_SYM) {
-        if (strcmp(value->sym, "dir") == 0) {
+    if (lval_type(value) == LVAL_SYM) {
+        if (value->sym == lsym_dir) {
             lenv_print_dir(env);
             lval_free(value);
-            return lval_sexpr();
+            return lval_empty();
         }
         lval *result = lenv_get(env, value);
         lval_free(value);
         return result;
     }
-    if (value->type == LVAL_SEXPR) {
+    if (lval_type(value) == LVAL_SEXPR) {
         return lval_eval_sexpr(env, value);
     }
     return value;
@@ -421,39 +966,111 @@ lval *lval_eval(lenv *env, lval *value) {
 
 lval *lval_eval_sexpr(lenv *env, lval *value) {
 
+    // Empty expressions return self
+    if (value->count == 0) { return value; }
+
+    // Children are evaluated in place, which needs a private list
+    value = lval_unshare(value);
+    lval_own_cells(value);
+
     // Evaluate children, rethrowing errors if any
     int i;
     for (i = 0; i < value->count; i++) {
         value->cell[i] = lval_eval(env, value->cell[i]);
         // Check if evaluation error
-        if (value->cell[i]->type == LVAL_ERR) { return lval_extract(value, i); }
+        if (lval_type(value->cell[i]) == LVAL_ERR) { return lval_extract(value, i); }
     }
 
-    // Empty expressions return self, single expr extract value
+    // Single expr extract value
     // Exception for dir!
-    if (value->count == 0) { return value; }
     if (value->count == 1) { return lval_extract(value, 0); }
 
     // Multiple element sexpr
     // Check if first element is func
     lval *func = lval_pop(value, 0);
-    if (func->type != LVAL_FUNC) {
-        lval *error = lval_err("'%s' is not a function", lval_type_name(func->type));
+    if (lval_type(func) != LVAL_FUNC) {
+        lval *error = lval_err("'%s' is not a function", lval_type_name(lval_type(func)));
         lval_free(func);
         lval_free(value);
         return error;
     }
 
     // Call operator on rest of elements
+    // Collector safepoints are disabled while calls are in progress
+    lgc_call_depth++;
     lval *result = lval_call(env, func, value);
-    lval_free(func);
+    lgc_call_depth--;
     return result;
 }
 
+// Whether formals take variable arguments with &
+static int lval_has_rest(lval *formals) {
+    int i;
+    for (i = 0; i < formals->count; i++) {
+        if (formals->cell[i]->sym == lsym_rest) { return 1; }
+    }
+    return 0;
+}
+
 // Function call
+// Takes ownership of both func and args
+// Builtins still allowed once the active quota context is over its limit,
+// so a tenant can drop bindings or be given more room
+static int lval_quota_exempt(lval *func) {
+    return func->builtin == builtin_def || func->builtin == builtin_put
+        || func->builtin == builtin_quota;
+}
+
 lval *lval_call(lenv *env, lval *func, lval *args) {
+    // Every loop goes through calls, so runaway allocation stops here
+    // Lists still queued for the background thread count until freed
+    if (lquota_over() && !lval_quota_exempt(func)) { ldefer_drain(); }
+    if (lquota_over() && !lval_quota_exempt(func)) {
+        lval_free(func);
+        lval_free(args);
+        return lval_err("memory quota exceeded");
+    }
+
     // Built-in function call
-    if (func->builtin) { return func->builtin(env, args); }
+    if (func->builtin) {
+        lval *result = func->builtin(env, args);
+        lval_free(func);
+        return result;
+    }
+
+    // A call supplying every argument at once binds them into a pooled
+    // frame and leaves the function untouched
+    if (func->env->count == 0 && args->count == func->formals->count
+        && !lval_has_rest(func->formals)) {
+        lenv *frame = lenv_frame(args->count);
+        int i;
+        // Like the environment of a scratch function, a frame opened
+        // during an arena form dies with the call and keeps scratch values
+        frame->scratch = arena_open || (func->flags & LVAL_FLAG_SCRATCH);
+        for (i = 0; i < func->formals->count; i++) {
+            lval *sym = func->formals->cell[i];
+            // Formals may name a constant defined after the lambda was made
+            if (LSYM_NAME(sym->sym)->constant) {
+                lenv_frame_release(frame);
+                lval_free(args);
+                lval_free(func);
+                return lval_err("Cannot bind constant '%s' as an argument.", sym->sym);
+            }
+            lenv_put_move(frame, sym, lval_pop(args, 0));
+        }
+        lval_free(args);
+        frame->parent = env;
+        lval *result = builtin_eval(frame, lval_add(lval_sexpr(), lval_ref(func->body)));
+        lenv_frame_release(frame);
+        lval_free(func);
+        return result;
+    }
+
+    // Binding arguments consumes formals and fills env, so work on a
+    // private copy of the function if it is still bound elsewhere
+    func = lval_unshare(func);
+    func->formals = lval_unshare(func->formals);
+    func->env = lenv_unshare(func->env);
 
     int supplied_arg_count = args->count;
     int required_arg_count = func->formals->count;
@@ -461,6 +1078,7 @@ lval *lval_call(lenv *env, lval *func, lval *args) {
         // Ran out of formal arguments to bind
         if (func->formals->count == 0) {
             lval_free(args);
+            lval_free(func);
             return lval_err(
                 "Function passed too many arguments. Expected at most %s instead of %s.",
                 required_arg_count, supplied_arg_count);
@@ -469,33 +1087,50 @@ lval *lval_call(lenv *env, lval *func, lval *args) {
         // Bind arguments
         lval *sym = lval_pop(func->formals, 0);
         // Variable arguments using &
-        if (strcmp(sym->sym, "&") == 0) {
+        if (sym->sym == lsym_rest) {
             if (func->formals->count != 1) {
                 lval_free(args);
+                lval_free(func);
+                lval_free(sym);
                 return lval_err("Function format invalid. "
                     "Symbol '&' not following by single symbol.");
             }
             lval *next_sym = lval_pop(func->formals, 0);
+            if (LSYM_NAME(next_sym->sym)->constant) {
+                lval *err = lval_err("Cannot bind constant '%s' as an argument.", next_sym->sym);
+                lval_free(args);
+                lval_free(func);
+                lval_free(sym);
+                lval_free(next_sym);
+                return err;
+            }
 
             // Assign to variable arg sym the qexpr list of args
-            lenv_put(func->env, next_sym, builtin_list(env, args));
+            lenv_put_move(func->env, next_sym, builtin_list(env, args));
+            args = NULL;
             lval_free(sym);
             lval_free(next_sym);
             break;
         }
 
-        lval *val = lval_pop(args, 0);
-        lenv_put(func->env, sym, val);
+        if (LSYM_NAME(sym->sym)->constant) {
+            lval *err = lval_err("Cannot bind constant '%s' as an argument.", sym->sym);
+            lval_free(args);
+            lval_free(func);
+            lval_free(sym);
+            return err;
+        }
+        lenv_put_move(func->env, sym, lval_pop(args, 0));
         lval_free(sym);
-        lval_free(val);
     }
-    lval_free(args);
+    if (args) { lval_free(args); }
 
     // If variable args not supplied, i.e.
     // & still exists in formals (check if accessing formal args valid first!)
-    if ((func->formals->count > 0) && strcmp(func->formals->cell[0]->sym, "&") == 0) {
+    if ((func->formals->count > 0) && func->formals->cell[0]->sym == lsym_rest) {
         // Continue to check formatting of variable args
         if (func->formals->count != 2) {
+            lval_free(func);
             return lval_err("Function format invalid. "
                 "Symbol '&' not followed by single symbol.");
         }
@@ -503,10 +1138,14 @@ lval *lval_call(lenv *env, lval *func, lval *args) {
         // Remove '&' symbol and bind empty list to varg sym
         lval_free(lval_pop(func->formals, 0));
         lval *sym = lval_pop(func->formals, 0);
-        lval *val = lval_qexpr();
-        lenv_put(func->env, sym, val);
+        if (LSYM_NAME(sym->sym)->constant) {
+            lval *err = lval_err("Cannot bind constant '%s' as an argument.", sym->sym);
+            lval_free(func);
+            lval_free(sym);
+            return err;
+        }
+        lenv_put_move(func->env, sym, lval_qexpr());
         lval_free(sym);
-        lval_free(val);
     }
 
     if (func->formals->count == 0) {
@@ -515,10 +1154,12 @@ lval *lval_call(lenv *env, lval *func, lval *args) {
         // Answer: Need to bind parent of func->env, so that variables bound in current_env can be accessed (e.g. globals)
         //         the func is otherwise limited to only the formal arguments bound in its own env
         func->env->parent = env;
-        return builtin_eval(func->env, lval_add(lval_sexpr(), lval_copy(func->body)));
+        lval *result = builtin_eval(func->env, lval_add(lval_sexpr(), lval_ref(func->body)));
+        lval_free(func);
+        return result;
     } else {
         // Return partially evaluated function
-        return lval_copy(func);
+        return func;
     }
 
 }
@@ -529,94 +1170,313 @@ lval *lval_call(lenv *env, lval *func, lval *args) {
 
 // lenv constructors and methods
 lenv *lenv_new(void) {
-    lenv *env = malloc(sizeof(lenv));
+    lenv *env = lalloc(sizeof(lenv));
+    env->refcount = 1;
     env->parent = NULL; // No parent environment
+    env->scratch = 0;
+    env->global = 0;
     env->count = 0;
+    env->capacity = 0;
     env->syms = NULL;
     env->vals = NULL;
+    env->index = NULL;
+    return env;
+}
+
+// Where def binds, see lenv_def
+static lenv *global_env = NULL;
+
+lenv *lenv_new_global(void) {
+    lenv *env = lenv_new();
+    env->global = 1;
+    global_env = env;
     return env;
 }
 
+// Free the tables and the lenv itself, leaving the values alone
+void lenv_release(lenv *env) {
+    int i;
+    for (i = 0; i < env->count; i++) {
+        lsym_name *name = LSYM_NAME(env->syms[i]);
+        name->bindings--;
+        if (env->global) {
+            name->global_slot = -1;
+            name->global = NULL;
+        }
+    }
+    lfree(env->syms, sizeof(char *) * env->capacity);
+    lfree(env->vals, sizeof(lval *) * env->capacity);
+    if (env->index) { lfree(env->index, sizeof(int) * LENV_INDEX_SIZE(env)); }
+    if (env == global_env) { global_env = NULL; }
+    lfree(env, sizeof(lenv));
+}
+
+// Drop a reference to env, freeing it and its values with the last one
 void lenv_free(lenv *env) {
+    if (--env->refcount > 0) { return; }
     int i;
     for (i = 0; i < env->count; i++) {
-        free(env->syms[i]);
         lval_free(env->vals[i]);
     }
-    free(env->syms);
-    free(env->vals);
-    free(env);
+    lenv_release(env);
 }
 
-// Get variable from environment
-lval *lenv_get(lenv *env, lval *key) {
+// Names are interned, so their address is hash enough once mixed
+static unsigned lenv_hash(char *sym) {
+    uintptr_t hash = (uintptr_t) sym;
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+    return (unsigned) hash;
+}
+
+// Position of sym in env->syms, or -1 if it is not bound here
+static int lenv_find(lenv *env, char *sym) {
     int i;
-    for (i = 0; i < env->count; i++) {
-        if (strcmp(env->syms[i], key->sym) == 0) {
-            return lval_copy(env->vals[i]);
+    if (env->index == NULL) {
+        for (i = 0; i < env->count; i++) {
+            if (env->syms[i] == sym) { return i; }
         }
+        return -1;
     }
-    // Check in parent environment if it exists
-    if (env->parent) {
-        return lenv_get(env->parent, key);
+    int mask = LENV_INDEX_SIZE(env) - 1;
+    int slot;
+    for (slot = lenv_hash(sym) & mask; (i = env->index[slot]) >= 0; slot = (slot + 1) & mask) {
+        if (env->syms[i] == sym) { return i; }
     }
+    return -1;
+}
+
+static void lenv_index_add(lenv *env, int i) {
+    int mask = LENV_INDEX_SIZE(env) - 1;
+    int slot = lenv_hash(env->syms[i]) & mask;
+    while (env->index[slot] >= 0) { slot = (slot + 1) & mask; }
+    env->index[slot] = i;
+}
+
+// Double the room for bindings, indexing them once there are too many
+// to scan
+static void lenv_grow(lenv *env) {
+    int capacity = env->capacity ? env->capacity * 2 : 4;
+    env->syms = lrealloc(env->syms, sizeof(char *) * env->capacity,
+        sizeof(char *) * capacity);
+    env->vals = lrealloc(env->vals, sizeof(lval *) * env->capacity,
+        sizeof(lval *) * capacity);
+    if (env->index) { lfree(env->index, sizeof(int) * LENV_INDEX_SIZE(env)); }
+    env->capacity = capacity;
+    env->index = NULL;
+
+    if (capacity > LENV_SCAN_MAX) {
+        env->index = lalloc(sizeof(int) * LENV_INDEX_SIZE(env));
+        int i;
+        for (i = 0; i < LENV_INDEX_SIZE(env); i++) { env->index[i] = -1; }
+        for (i = 0; i < env->count; i++) { lenv_index_add(env, i); }
+    }
+}
+
+// Get variable from environment
+//
+// Scope is dynamic, so a global reached from deep inside a recursion
+// would be searched for in every frame of it. Instead it is read from
+// the value cell of its name. That is only right if no nearer binding of
+// the same name, e.g. a formal, hides the global, which is ruled out as
+// long as the global one is the only binding of the name anywhere.
+//
+// Builtins come last, after every environment. A name no environment
+// binds at all is therefore a builtin or unbound without any search.
+// Constants are found first, nothing may bind their name again.
+lval *lenv_get(lenv *env, lval *key) {
+    // A symbol resolved by lval_lambda is tried at its slot first
+    int slot = key->slot - 1;
+    if (slot >= 0 && slot < env->count && env->syms[slot] == key->sym) {
+        return lval_ref(env->vals[slot]);
+    }
+    lsym_name *name = LSYM_NAME(key->sym);
+    if (name->constant) { return lval_ref(name->constant); }
+    if (name->bindings == 0 && name->builtin) { return name->builtin; }
+    if (name->global_slot >= 0 && name->bindings == 1) {
+        return lval_ref(name->global);
+    }
+
+    // Check in parent environments until found
+    for (; env; env = env->parent) {
+        int i = lenv_find(env, key->sym);
+        if (i >= 0) { return lval_ref(env->vals[i]); }
+    }
+    if (name->builtin) { return name->builtin; } // Immortal, no reference
     return lval_err("Unbound symbol '%s'", key->sym);
 }
 
+// Bind key to its own reference to value, the caller keeps theirs
 void lenv_put(lenv *env, lval *key, lval *value) {
-    int i;
-    for (i = 0; i < env->count; i++) {
-        if (strcmp(env->syms[i], key->sym) == 0) {
-            lval_free(env->vals[i]); // Replaces variable name
-            env->vals[i] = lval_copy(value);
-            return;
-        }
+    lenv_put_move(env, key, lval_ref(value));
+}
+
+// lenv_put taking over the caller's reference to value
+// A value fresh from evaluation is bound without touching its refcount,
+// so it stays unshared and can still be modified in place.
+void lenv_put_move(lenv *env, lval *key, lval *value) {
+    // Lasting environments must not point into the arena
+    if (!env->scratch) { value = lval_promote(value); }
+
+    lsym_name *name = LSYM_NAME(key->sym);
+    int i = env->global ? name->global_slot : lenv_find(env, key->sym);
+    if (i >= 0) {
+        lval_free(env->vals[i]); // Replaces variable name
+        env->vals[i] = value;
+        if (env->global) { name->global = value; }
+        return;
     }
 
     // No existing entry found
-    env->count++;
-    env->vals = realloc(env->vals, sizeof(lval *) * env->count);
-    env->vals[env->count-1] = lval_copy(value);
+    if (env->count == env->capacity) { lenv_grow(env); }
+    i = env->count++;
+    env->syms[i] = key->sym; // Interned, shared with key
+    name->bindings++;
+    env->vals[i] = value;
+    if (env->index) { lenv_index_add(env, i); }
+    if (env->global) {
+        name->global_slot = i;
+        name->global = value;
+    }
+}
 
-    env->syms = realloc(env->syms, sizeof(char *) * env->count);
-    env->syms[env->count-1] = malloc(strlen(key->sym) + 1);
-    strcpy(env->syms[env->count-1], key->sym);
+lenv *lenv_ref(lenv *env) {
+    env->refcount++;
+    return env;
+}
+
+// Copy on bind: returns env itself if the caller holds the only
+// reference, otherwise trades the caller's reference for a private copy
+lenv *lenv_unshare(lenv *env) {
+    if (env->refcount == 1) { return env; }
+    env->refcount--;
+    return lenv_copy(env);
 }
 
 lenv *lenv_copy(lenv *env) {
-    lenv *copy = malloc(sizeof(lenv));
+    lenv *copy = lalloc(sizeof(lenv));
+    copy->refcount = 1;
     copy->parent = env->parent;
+    copy->scratch = 0;
+    copy->global = 0;
     copy->count = env->count;
-    copy->syms = malloc(sizeof(char *) * env->count);
-    copy->vals = malloc(sizeof(lval *) * env->count);
+    copy->capacity = env->capacity;
+    copy->syms = lalloc(sizeof(char *) * env->capacity);
+    copy->vals = lalloc(sizeof(lval *) * env->capacity);
+    copy->index = NULL;
+    if (env->index) {
+        copy->index = lalloc(sizeof(int) * LENV_INDEX_SIZE(env));
+        memcpy(copy->index, env->index, sizeof(int) * LENV_INDEX_SIZE(env));
+    }
     int i;
     for (i = 0; i < env->count; i++) {
-        copy->syms[i] = malloc(strlen(env->syms[i]) + 1); // copy symbols
-        strcpy(copy->syms[i], env->syms[i]);
-        copy->vals[i] = lval_copy(env->vals[i]);
+        copy->syms[i] = env->syms[i];
+        copy->vals[i] = lval_ref(env->vals[i]);
+        LSYM_NAME(copy->syms[i])->bindings++;
     }
     return copy;
 }
 
+// Call frames
+// Released frames keep their binding arrays and wait in a pool per
+// capacity, so a recursion only allocates frames the first time it gets
+// that deep. Frames too large to scan are not pooled.
+//
+// For quotas, pooling a frame counts as freeing it and reusing one as
+// allocating it: the pool's frames are charged to the global context.
+#define LENV_FRAME_CLASSES 2 // capacities 4 and 8
+#define LENV_FRAME_POOL 256 // frames kept per class
+
+static lenv *frame_pool[LENV_FRAME_CLASSES][LENV_FRAME_POOL];
+static int frame_pool_count[LENV_FRAME_CLASSES];
+
+static int lenv_frame_class(int capacity) {
+    return capacity <= 4 ? 0 : 1;
+}
+
+static void lenv_frame_charge(lenv *env, int from, int to) {
+    lquota_move(sizeof(lenv), from, to);
+    lquota_move(sizeof(char *) * env->capacity, from, to);
+    lquota_move(sizeof(lval *) * env->capacity, from, to);
+}
+
+// Empty environment with room for arity bindings
+lenv *lenv_frame(int arity) {
+    int class = lenv_frame_class(arity);
+    lenv *env;
+    if (arity <= LENV_SCAN_MAX && frame_pool_count[class]) {
+        env = frame_pool[class][--frame_pool_count[class]];
+        lenv_frame_charge(env, 0, lquota_active);
+    } else {
+        env = lenv_new();
+    }
+    while (env->capacity < arity) { lenv_grow(env); }
+    return env;
+}
+
+// Drop the caller's frame, back to the pool if it can be reused
+void lenv_frame_release(lenv *env) {
+    int class = lenv_frame_class(env->capacity);
+    if (env->refcount > 1 || env->capacity > LENV_SCAN_MAX
+        || frame_pool_count[class] == LENV_FRAME_POOL) {
+        lenv_free(env);
+        return;
+    }
+    int i;
+    for (i = 0; i < env->count; i++) {
+        LSYM_NAME(env->syms[i])->bindings--;
+        lval_free(env->vals[i]);
+    }
+    env->count = 0;
+    env->parent = NULL;
+    env->scratch = 0;
+    lenv_frame_charge(env, lquota_active, 0);
+    frame_pool[class][frame_pool_count[class]++] = env;
+}
+
+// Environment that global definitions bind in
+// That is the global environment when there is one, whose bindings
+// lenv_put_move writes through the name's slot without walking or
+// searching. Other environment trees define in their root.
+static lenv *lenv_root(lenv *env) {
+    if (global_env) { return global_env; }
+    for (; env->parent; env = env->parent);
+    return env;
+}
+
 // Global definition
 void lenv_def(lenv *env, lval *key, lval *value) {
-    // Access root environment to define var there
-    for (; env->parent; env = env->parent);
-    lenv_put(env, key, value);
+    lenv_put(lenv_root(env), key, value);
+}
+
+void lenv_def_move(lenv *env, lval *key, lval *value) {
+    lenv_put_move(lenv_root(env), key, value);
+}
+
+// Global definition that can never be rebound
+// The value stays bound in the root environment, which keeps it alive,
+// and its name points straight at it for lenv_get. Callers check that
+// key is not bound yet. Calls check each formal they bind, since a
+// function made earlier may name the constant as an argument.
+void lenv_def_const(lenv *env, lval *key, lval *value) {
+    env = lenv_root(env);
+    lenv_put_move(env, key, value);
+    LSYM_NAME(key->sym)->constant = env->vals[lenv_find(env, key->sym)];
 }
 
 void lenv_print_dir(lenv *env) {
     /* Print names of all bound variables */
-    int i;
+    int i, n = 0;
+    // The global environment lists builtins first, each once even if
+    // redefined
+    if (env->global) {
+        for (i = 0; i < lbuiltin_count; i++) {
+            printf(" %2d: %s\n", n++, lbuiltins[i].name);
+        }
+    }
     for (i = 0; i < env->count; i++) {
-        printf(" %2d: %s\n", i, env->syms[i]);
+        if (env->global && LSYM_NAME(env->syms[i])->builtin) { continue; }
+        printf(" %2d: %s\n", n++, env->syms[i]);
     }
 }
-
-void lenv_add_builtin_func(lenv *env, char *name, lbuiltin func) {
-    lval *key = lval_sym(name);
-    lval *value = lval_func(func);
-    lenv_put(env, key, value);
-    lval_free(key);
-    lval_free(value);
-}